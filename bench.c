@@ -0,0 +1,262 @@
+#include <ctype.h>
+#include <getopt.h>
+#include <inttypes.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <unistd.h>
+
+#include "mem.h"
+
+#define DEFAULT_REPEATS 5
+#define DEFAULT_WARMUP	1
+
+typedef uint64_t vec128_t __attribute__((vector_size(16)));
+
+static volatile uint64_t bench_sink;
+
+/*
+ * One set of kernels per access width. All accesses go through volatile
+ * pointers so the compiler keeps exactly one load or store of the given width
+ * per element, like a device would see it.
+ */
+#define BENCH_KERNELS(type, name)                                                                                      \
+	static void read_##name(char *p, size_t len)                                                                   \
+	{                                                                                                              \
+		volatile type *s = (volatile type *)p;                                                                 \
+		type acc = {0};                                                                                        \
+		for (size_t i = 0; i < len / sizeof(type); i++)                                                        \
+			acc ^= s[i];                                                                                   \
+		uint64_t out = 0;                                                                                      \
+		memcpy(&out, &acc, sizeof(acc) < sizeof(out) ? sizeof(acc) : sizeof(out));                            \
+		bench_sink = out;                                                                                      \
+	}                                                                                                              \
+	static void write_##name(char *p, size_t len)                                                                  \
+	{                                                                                                              \
+		volatile type *d = (volatile type *)p;                                                                 \
+		type val = {0};                                                                                        \
+		for (size_t i = 0; i < len / sizeof(type); i++)                                                        \
+			d[i] = val;                                                                                    \
+	}                                                                                                              \
+	static void copy_##name(char *p, size_t len)                                                                   \
+	{                                                                                                              \
+		volatile type *s = (volatile type *)p;                                                                 \
+		volatile type *d = (volatile type *)(p + len / 2);                                                     \
+		for (size_t i = 0; i < len / 2 / sizeof(type); i++)                                                    \
+			d[i] = s[i];                                                                                   \
+	}                                                                                                              \
+	static void rmw_##name(char *p, size_t len)                                                                    \
+	{                                                                                                              \
+		volatile type *d = (volatile type *)p;                                                                 \
+		for (size_t i = 0; i < len / sizeof(type); i++)                                                        \
+			d[i] = ~d[i];                                                                                  \
+	}
+
+BENCH_KERNELS(uint8_t, 8)
+BENCH_KERNELS(uint16_t, 16)
+BENCH_KERNELS(uint32_t, 32)
+BENCH_KERNELS(uint64_t, 64)
+BENCH_KERNELS(vec128_t, 128)
+
+#define BENCH_ENTRIES(name)                                                                                            \
+	{"read", name, 1, read_##name}, {"write", name, 1, write_##name}, {"copy", name, 1, copy_##name},              \
+	    {"rmw", name, 2, rmw_##name}
+
+// clang-format off
+static const struct bench_kernel {
+	const char *name;
+	int width;
+	int accesses;	/* bytes moved per byte of range, a read and a write for rmw */
+	void (*func)(char *p, size_t len);
+	} kernels[] = {
+		BENCH_ENTRIES(8),
+		BENCH_ENTRIES(16),
+		BENCH_ENTRIES(32),
+		BENCH_ENTRIES(64),
+		BENCH_ENTRIES(128),
+		{0}
+	};
+// clang-format on
+
+static void do_bench_help(FILE *output)
+{
+	fprintf(output, "Usage:\nmem bench [options] <address> <size>\n\n");
+	fprintf(output, "Measure read, write, copy and read-modify-write bandwidth of a memory range\n");
+	fprintf(output, "for 8, 16, 32, 64 and 128 bit accesses.\n");
+	fprintf(output, "WARNING: every kernel but read overwrites the range.\n");
+	fprintf(output, "Options:\n");
+	fprintf(output, " -m, --mem-dev\t\t memory device to use (default is /dev/mem)\n");
+	fprintf(output, " -k, --kernels\t\t comma separated kernels to run (default is read,write,copy,rmw)\n");
+	fprintf(output, " -r, --repeats\t\t timed runs per kernel (default is 5)\n");
+	fprintf(output, " -w, --warmup\t\t untimed runs per kernel (default is 1)\n");
+	fprintf(output, " -h, --help\t\t Display this help screen\n");
+	fprintf(output, "Arguments:\n");
+	fprintf(output, " <address> and <size> can be given in decimal, hexedecimal or octal format\n");
+	fprintf(output, " depending of the prefix (no-prefix, 0x, and 0).\n");
+}
+
+static int cmp_u64(const void *a, const void *b)
+{
+	uint64_t x = *(const uint64_t *)a, y = *(const uint64_t *)b;
+
+	return x < y ? -1 : x > y;
+}
+
+static bool kernel_selected(const char *list, const char *name)
+{
+	size_t len = strlen(name);
+
+	for (const char *p = list; (p = strstr(p, name)); p += len)
+		if ((p == list || p[-1] == ',') && (p[len] == ',' || p[len] == '\0'))
+			return true;
+
+	return false;
+}
+
+static void run_kernel(const struct bench_kernel *k, char *p, size_t len, int repeats, int warmup, uint64_t *times)
+{
+	for (int i = 0; i < warmup; i++)
+		k->func(p, len);
+
+	for (int i = 0; i < repeats; i++) {
+		uint64_t start = get_time_ns();
+
+		k->func(p, len);
+		times[i] = get_time_ns() - start;
+	}
+	qsort(times, repeats, sizeof(*times), cmp_u64);
+}
+
+int do_bench(int argc, char **argv)
+{
+	int c;
+	off_t target;
+	off_t size;
+	off_t repeats = DEFAULT_REPEATS;
+	off_t warmup = DEFAULT_WARMUP;
+	const char *selected = "read,write,copy,rmw";
+	char *memdev = "/dev/mem";
+	struct mapped_mem mem;
+	uint64_t *times;
+	int prot = PROT_READ;
+	size_t skip, len;
+	char *p;
+
+	while (1) {
+		// clang-format off
+		static struct option long_options[] = {
+			{"mem-dev", required_argument, 0, 'm'},
+			{"kernels", required_argument, 0, 'k'},
+			{"repeats", required_argument, 0, 'r'},
+			{"warmup", required_argument, 0, 'w'},
+			{"help", no_argument, 0, 'h'},
+			{0, 0, 0, 0}
+		};
+		// clang-format on
+		int option_index = 0;
+
+		c = getopt_long(argc, argv, "m:k:r:w:h", long_options, &option_index);
+
+		/* Detect the end of the options. */
+		if (c == -1)
+			break;
+
+		switch (c) {
+		case 'm':
+			memdev = optarg;
+			break;
+		case 'k':
+			selected = optarg;
+			break;
+		case 'r':
+			if (parse_input(optarg, &repeats)) {
+				do_bench_help(stderr);
+				return EXIT_FAILURE;
+			}
+			break;
+		case 'w':
+			if (parse_input(optarg, &warmup)) {
+				do_bench_help(stderr);
+				return EXIT_FAILURE;
+			}
+			break;
+		case 'h':
+			do_bench_help(stdout);
+			return EXIT_SUCCESS;
+		case '?':
+			/* getopt_long already printed an error message. */
+			return EXIT_FAILURE;
+		default:
+			fprintf(stderr, "Unsupported option\n");
+			do_bench_help(stderr);
+			return EXIT_FAILURE;
+			break;
+		}
+	};
+
+	if (argc - optind != 2) {
+		fprintf(stderr, "Missing address or size\n");
+		do_bench_help(stderr);
+		return EXIT_FAILURE;
+	}
+
+	if (parse_input(argv[optind], &target)) {
+		do_bench_help(stderr);
+		return EXIT_FAILURE;
+	}
+
+	if (parse_input(argv[optind + 1], &size)) {
+		do_bench_help(stderr);
+		return EXIT_FAILURE;
+	}
+
+	if (repeats < 1) {
+		fprintf(stderr, "At least one repeat is needed\n");
+		return EXIT_FAILURE;
+	}
+
+	/* Run every kernel on a 16 byte aligned range so all widths are naturally aligned */
+	skip = -target & (sizeof(vec128_t) - 1);
+	if (size < skip + 2 * sizeof(vec128_t)) {
+		fprintf(stderr, "Range too small to benchmark\n");
+		return EXIT_FAILURE;
+	}
+	len = (size - skip) & ~(2 * sizeof(vec128_t) - 1);
+
+	times = calloc(repeats, sizeof(*times));
+	if (!times)
+		return EXIT_FAILURE;
+
+	/* Read-only devices can still be benchmarked as long as nothing writes */
+	for (const struct bench_kernel *k = kernels; k->name; k++)
+		if (strcmp(k->name, "read") && kernel_selected(selected, k->name))
+			prot |= PROT_WRITE;
+
+	if (map_memory(memdev, size, prot, target, &mem)) {
+		free(times);
+		return EXIT_FAILURE;
+	}
+	p = mem.v_ptr + skip;
+
+	printf("%-6s %5s %10s %10s %10s  (GB/s over %zu bytes, %s mapping)\n", "kernel", "width", "min", "median", "max",
+	       len, memory_cache_mode(memdev, target, target + size));
+	for (const struct bench_kernel *k = kernels; k->name; k++) {
+		double bytes = (double)len * k->accesses;
+
+		if (!kernel_selected(selected, k->name))
+			continue;
+
+		run_kernel(k, p, len, repeats, warmup, times);
+		printf("%-6s %5d %10.3f %10.3f %10.3f\n", k->name, k->width, bytes / times[repeats - 1],
+		       bytes / times[repeats / 2], bytes / times[0]);
+		fflush(stdout);
+	}
+
+	unmap_memory(&mem);
+	free(times);
+
+	return EXIT_SUCCESS;
+}
@@ -1,73 +1,948 @@
+#define _GNU_SOURCE
 #include <ctype.h>
+#include <dirent.h>
+#include <errno.h>
 #include <fcntl.h>
 #include <inttypes.h>
 #include <limits.h>
+#include <pthread.h>
+#include <sched.h>
 #include <stdint.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
 #include <sys/mman.h>
 #include <sys/stat.h>
+#include <sys/sysmacros.h>
+#include <time.h>
 #include <unistd.h>
 
 #include "mem.h"
 
-int map_memory(char *memdev, off_t size, int props, off_t target, struct mapped_mem *mem)
+/* How device memory gets mapped, see --cache */
+static enum cache_policy {
+	CACHE_AUTO,
+	CACHE_UC,
+	CACHE_WC,
+	CACHE_WB,
+} cache_policy;
+
+static const char *const cache_policy_names[] = {"auto", "uc", "wc", "wb"};
+
+/* MAP_OPT_* flags applied to every new mapping */
+static int map_options;
+
+/* What memdev is, which decides how its ranges are mapped by default */
+enum memdev_kind {
+	MEMDEV_FILE,
+	MEMDEV_MEM,
+	MEMDEV_DEVICE,
+};
+
+struct ram_range {
+	uint64_t start;
+	uint64_t end;
+};
+
+int set_cache_policy(const char *name)
+{
+	for (int i = CACHE_AUTO; i <= CACHE_WB; i++)
+		if (!strcmp(name, cache_policy_names[i])) {
+			cache_policy = i;
+			return 0;
+		}
+
+	fprintf(stderr, "Unknown cache policy %s\n", name);
+	return -1;
+}
+
+/*
+ * The System RAM ranges of /proc/iomem, read once. Without CAP_SYS_ADMIN the
+ * kernel shows every range as 0-0, which leaves nothing treated as RAM.
+ */
+static bool range_is_ram(uint64_t start, uint64_t end)
+{
+	static struct ram_range *ranges;
+	static int count = -1;
+
+	if (count < 0) {
+		FILE *iomem = fopen("/proc/iomem", "r");
+		char line[256];
+
+		count = 0;
+		while (iomem && fgets(line, sizeof(line), iomem)) {
+			uint64_t s, e;
+			int name = 0;
+			struct ram_range *grown;
+
+			if (sscanf(line, " %" SCNx64 "-%" SCNx64 " : %n", &s, &e, &name) != 2 || !name)
+				continue;
+			if (strncmp(line + name, "System RAM", strlen("System RAM")) || e <= s)
+				continue;
+
+			grown = realloc(ranges, (count + 1) * sizeof(*ranges));
+			if (!grown)
+				break;
+			ranges = grown;
+			ranges[count].start = s;
+			ranges[count++].end = e;
+		}
+		if (iomem)
+			fclose(iomem);
+	}
+
+	for (int i = 0; i < count; i++)
+		if (ranges[i].start <= start && end - 1 <= ranges[i].end)
+			return true;
+
+	return false;
+}
+
+static enum memdev_kind memdev_kind(const char *memdev)
+{
+	struct stat st;
+
+	if (stat(memdev, &st))
+		return MEMDEV_DEVICE;
+	if (S_ISREG(st.st_mode))
+		return MEMDEV_FILE;
+	if (S_ISCHR(st.st_mode) && st.st_rdev == makedev(1, 1))
+		return MEMDEV_MEM;
+
+	return MEMDEV_DEVICE;
+}
+
+/* Whether [start, end) of a memdev of the given kind has to be mapped uncached */
+static bool kind_uncached(enum memdev_kind kind, off_t start, off_t end)
+{
+	switch (cache_policy) {
+	case CACHE_UC:
+		return true;
+	case CACHE_WC:
+	case CACHE_WB:
+		return false;
+	default:
+		break;
+	}
+
+	switch (kind) {
+	case MEMDEV_FILE:
+		/* O_SYNC only makes every write to a plain file wait for the disk */
+		return false;
+	case MEMDEV_MEM:
+		/* Only /dev/mem ranges are known to the iomem resource tree */
+		return !range_is_ram(start, end);
+	default:
+		return true;
+	}
+}
+
+/* Whether [start, end) of memdev has to be mapped uncached (opened O_SYNC) */
+bool memory_uncached(const char *memdev, off_t start, off_t end)
+{
+	if (cache_policy != CACHE_AUTO)
+		return cache_policy == CACHE_UC;
+
+	return kind_uncached(memdev_kind(memdev), start, end);
+}
+
+/* The mapping type of [start, end), open_memory() refuses wc wherever it can't be had */
+const char *memory_cache_mode(const char *memdev, off_t start, off_t end)
+{
+	if (cache_policy == CACHE_WC)
+		return "wc";
+
+	return memory_uncached(memdev, start, end) ? "uc" : "wb";
+}
+
+/*
+ * Write-combining can only be asked for through the resourceN_wc file of a
+ * PCI BAR. Finds it into path when memdev is the matching resourceN.
+ */
+static bool memory_wc_path(const char *memdev, char *path, size_t len)
+{
+	const char *suffix = strrchr(memdev, '/');
+
+	suffix = suffix ? suffix + 1 : memdev;
+
+	return !strncmp(suffix, "resource", strlen("resource")) && isdigit((unsigned char)suffix[strlen("resource")]) &&
+	       !strchr(suffix, '_') && snprintf(path, len, "%s_wc", memdev) < (int)len && !access(path, F_OK);
+}
+
+/*
+ * Open memdev for a cached or an uncached mapping. /dev/mem maps System RAM
+ * write-back unless opened O_SYNC, device ranges keep whatever type the kernel
+ * tracks for them. A write-combining mapping is refused for anything but a
+ * PCI BAR with a resourceN_wc file, rather than silently getting another type.
+ */
+int open_memory(const char *memdev, int props, bool uncached)
 {
-	unsigned page_size, mapped_size, offset_in_page;
-	int page_count;
+	char wc_path[PATH_MAX];
 	int fd;
 	int oflags;
-	page_size = sysconf(_SC_PAGESIZE);
 
-	if ((props && PROT_WRITE) && !(props && PROT_READ))
-		oflags = O_WRONLY;
-	else if ((props && PROT_READ) && !(props && PROT_WRITE))
-		oflags = O_RDONLY;
-	else if (props && (PROT_WRITE | PROT_READ))
+	/* A shared mapping always needs a readable descriptor */
+	if (props & PROT_WRITE)
 		oflags = O_RDWR;
+	else if (props & PROT_READ)
+		oflags = O_RDONLY;
 	else
 		return -1;
 
-	fd = open(memdev, oflags | O_SYNC);
-	if (!fd) {
+	if (cache_policy == CACHE_WC) {
+		if (!memory_wc_path(memdev, wc_path, sizeof(wc_path))) {
+			fprintf(stderr, "%s can't be mapped write-combining, only a PCI BAR with a resourceN_wc file can\n",
+			        memdev);
+			return -1;
+		}
+		memdev = wc_path;
+	}
+
+	fd = open(memdev, oflags | (uncached ? O_SYNC : 0));
+	if (fd == -1) {
 		perror("Can't open memory device");
 		return -1;
 	}
 
+	return fd;
+}
+
+void set_map_options(int options)
+{
+	map_options = options;
+}
+
+static off_t huge_page_size(void)
+{
+	static off_t size;
+	FILE *f;
+
+	if (size)
+		return size;
+
+	size = 2 * 1024 * 1024;
+	f = fopen("/sys/kernel/mm/transparent_hugepage/hpage_pmd_size", "r");
+	if (f) {
+		long long val;
+
+		if (fscanf(f, "%lld", &val) == 1 && val > 0)
+			size = val;
+		fclose(f);
+	}
+
+	return size;
+}
+
+/*
+ * mmap() [start, start + len) of fd with the mapping options applied. For huge
+ * pages the virtual address is picked congruent to start modulo the huge page
+ * size, the precondition for the kernel to use PMD mappings wherever the
+ * backing allows, without mapping anything beyond the requested range.
+ */
+static void *map_range(int fd, off_t start, off_t len, int props)
+{
+	off_t huge = huge_page_size();
+	char *area = MAP_FAILED;
+	char *hint = NULL;
+	int flags = MAP_SHARED;
+	char *base;
+
+	if (map_options & MAP_OPT_PREFAULT)
+		flags |= MAP_POPULATE;
+
+	if ((map_options & MAP_OPT_HUGE) && len >= huge) {
+		area = mmap(NULL, len + huge, PROT_NONE, MAP_PRIVATE | MAP_ANONYMOUS | MAP_NORESERVE, -1, 0);
+		if (area != MAP_FAILED) {
+			hint = area + ((start - (off_t)(uintptr_t)area) & (huge - 1));
+			flags |= MAP_FIXED;
+		}
+	}
+
+	base = mmap(hint, len, props, flags, fd, start);
+	if (area != MAP_FAILED) {
+		if (base == MAP_FAILED) {
+			munmap(area, len + huge);
+			return MAP_FAILED;
+		}
+		/* Give back the reservation around the mapping */
+		if (hint > area)
+			munmap(area, hint - area);
+		if (area + len + huge > hint + len)
+			munmap(hint + len, area + len + huge - (hint + len));
+	}
+	if (base == MAP_FAILED)
+		return MAP_FAILED;
+
+	if (map_options & MAP_OPT_HUGE)
+		madvise(base, len, MADV_HUGEPAGE);
+	if (map_options & MAP_OPT_PREFAULT)
+		madvise(base, len, MADV_WILLNEED);
+	if ((map_options & MAP_OPT_LOCK) && mlock(base, len))
+		perror("Can't lock mapping in memory");
+
+	return base;
+}
+
+int map_memory_fd(int fd, off_t size, int props, off_t target, struct mapped_mem *mem)
+{
+	off_t page_size, mapped_size, offset_in_page;
+	off_t page_count;
+	uint64_t start = stats_start();
+
+	page_size = sysconf(_SC_PAGESIZE);
+
 	page_count = size / page_size;
 	if (size % page_size)
 		page_count++;
 
-	//	printf("Mapping %d pages\n",page_count);
 	mapped_size = page_count * page_size;
-	offset_in_page = (unsigned)target & (page_size - 1);
-	if (offset_in_page + size > page_size) {
+	offset_in_page = target & (page_size - 1);
+	if (offset_in_page + size > mapped_size) {
 		/* This access spans pages.
-		 * Must map two pages to make it possible: */
+		 * Must map one more page to make it possible: */
 		mapped_size += page_size;
 	}
-	//	printf("Mapped size: %d\n", mapped_size);
 
-	mem->base = mmap(NULL, mapped_size, props, MAP_SHARED, fd, target & ~(off_t)(page_size - 1));
+	mem->base = map_range(fd, target & ~(page_size - 1), mapped_size, props);
 	if (mem->base == MAP_FAILED) {
 		perror("Failed to map memory device to memory");
-		exit(EXIT_FAILURE);
+		return -1;
 	}
 
 	mem->mapped_size = mapped_size;
 	mem->v_ptr = (char *)mem->base + offset_in_page;
+	mem->window = NULL;
+	stats_account(STATS_MAP, start, size);
+
+	return EXIT_SUCCESS;
+}
+
+/*
+ * Mappings handed out by map_memory() stay cached after unmap_memory() so that
+ * repeated, overlapping and adjacent accesses reuse them instead of paying for
+ * open/mmap/munmap again. The device stays open as long as it is in use, and
+ * least recently used windows are unmapped once the total mapped size goes
+ * over the budget.
+ */
+struct map_window {
+	struct map_window *next;
+	off_t start;
+	off_t end;
+	void *base;
+	int props;
+	bool uncached;
+	unsigned int refs;
+	unsigned long last_use;
+	unsigned int generation;
+};
+
+static struct map_cache {
+	char *memdev;
+	enum memdev_kind kind;
+	/* Indexed by whether the descriptor was opened for uncached mappings */
+	int fd_ro[2];
+	int fd_rw[2];
+	unsigned int generation;
+	off_t budget;
+	off_t mapped;
+	unsigned long clock;
+	struct map_window *windows;
+} cache = {.fd_ro = {-1, -1}, .fd_rw = {-1, -1}, .budget = DEFAULT_MAP_BUDGET};
+
+static void map_window_drop(struct map_window **link)
+{
+	struct map_window *w = *link;
+
+	if (munmap(w->base, w->end - w->start) == -1)
+		perror("Can't unmap memory");
+	cache.mapped -= w->end - w->start;
+	*link = w->next;
+	free(w);
+}
+
+/* Unmap least recently used idle windows until extra more bytes fit the budget */
+static void map_cache_trim(off_t extra)
+{
+	while (cache.mapped + extra > cache.budget) {
+		struct map_window **link, **victim = NULL;
+
+		for (link = &cache.windows; *link; link = &(*link)->next)
+			if (!(*link)->refs && (!victim || (*link)->last_use < (*victim)->last_use))
+				victim = link;
+		if (!victim)
+			break;
+		map_window_drop(victim);
+	}
+}
+
+void map_cache_set_budget(off_t budget)
+{
+	cache.budget = budget;
+	map_cache_trim(0);
+}
+
+void map_cache_flush(void)
+{
+	struct map_window **link = &cache.windows;
+
+	while (*link) {
+		if (!(*link)->refs)
+			map_window_drop(link);
+		else
+			link = &(*link)->next;
+	}
+
+	for (int i = 0; i < 2; i++) {
+		if (cache.fd_ro[i] != -1)
+			close(cache.fd_ro[i]);
+		if (cache.fd_rw[i] != -1)
+			close(cache.fd_rw[i]);
+		cache.fd_ro[i] = cache.fd_rw[i] = -1;
+	}
+
+	free(cache.memdev);
+	cache.memdev = NULL;
+	cache.generation++;
+}
+
+/* Switch the cache over to memdev, whose kind is only looked up then */
+static void map_cache_select(const char *memdev)
+{
+	if (cache.memdev && strcmp(cache.memdev, memdev))
+		map_cache_flush();
+	if (!cache.memdev) {
+		cache.memdev = strdup(memdev);
+		cache.kind = memdev_kind(memdev);
+	}
+}
+
+static int map_cache_fd(const char *memdev, int props, bool uncached)
+{
+	if (props & PROT_WRITE) {
+		if (cache.fd_rw[uncached] == -1)
+			cache.fd_rw[uncached] = open_memory(memdev, props, uncached);
+		return cache.fd_rw[uncached];
+	}
+
+	if (cache.fd_rw[uncached] != -1)
+		return cache.fd_rw[uncached];
+	if (cache.fd_ro[uncached] == -1)
+		cache.fd_ro[uncached] = open_memory(memdev, props, uncached);
+	return cache.fd_ro[uncached];
+}
+
+int map_memory(char *memdev, off_t size, int props, off_t target, struct mapped_mem *mem)
+{
+	off_t page_size = sysconf(_SC_PAGESIZE);
+	off_t start = target & ~(page_size - 1);
+	off_t end = (target + size + page_size - 1) & ~(page_size - 1);
+	struct map_window **link, *w;
+	uint64_t since = stats_start();
+	bool uncached;
+	int fd;
+
+	if (end == start)
+		end += page_size;
+
+	/* Reusing a cached window takes no system call at all */
+	map_cache_select(memdev);
+	uncached = kind_uncached(cache.kind, start, end);
+
+	for (w = cache.windows; w; w = w->next)
+		if (w->generation == cache.generation && w->props == props && w->uncached == uncached &&
+		    w->start <= start && w->end >= end)
+			goto found;
+
+	fd = map_cache_fd(memdev, props, uncached);
+	if (fd == -1)
+		return -1;
+
+	/*
+	 * Grow the new window over idle windows of the same kind it overlaps or
+	 * touches, and replace them, as long as it still fits the budget on its
+	 * own. The total cached size is brought back under the budget below, by
+	 * evicting the least recently used idle windows.
+	 */
+	for (w = cache.windows; w; w = w->next) {
+		if (w->refs || w->generation != cache.generation || w->props != props || w->uncached != uncached ||
+		    w->start > end || w->end < start)
+			continue;
+		if ((end > w->end ? end : w->end) - (start < w->start ? start : w->start) > cache.budget)
+			continue;
+		if (w->start < start)
+			start = w->start;
+		if (w->end > end)
+			end = w->end;
+	}
+
+	link = &cache.windows;
+	while (*link) {
+		w = *link;
+		if (!w->refs && w->generation == cache.generation && w->props == props && w->uncached == uncached &&
+		    w->start >= start && w->end <= end)
+			map_window_drop(link);
+		else
+			link = &w->next;
+	}
+	map_cache_trim(end - start);
+
+	w = calloc(1, sizeof(*w));
+	if (!w)
+		return -1;
 
-	close(fd);
+	w->base = map_range(fd, start, end - start, props);
+	if (w->base == MAP_FAILED) {
+		perror("Failed to map memory device to memory");
+		free(w);
+		return -1;
+	}
+	w->start = start;
+	w->end = end;
+	w->props = props;
+	w->uncached = uncached;
+	w->generation = cache.generation;
+	w->next = cache.windows;
+	cache.windows = w;
+	cache.mapped += end - start;
+
+found:
+	w->refs++;
+	w->last_use = ++cache.clock;
+
+	start = target & ~(page_size - 1);
+	end = (target + size + page_size - 1) & ~(page_size - 1);
+	mem->window = w;
+	mem->base = (char *)w->base + (start - w->start);
+	mem->mapped_size = end - start;
+	mem->v_ptr = (char *)w->base + (target - w->start);
+	stats_account(STATS_MAP, since, size);
 
 	return EXIT_SUCCESS;
 }
 
 void unmap_memory(struct mapped_mem *mem)
 {
+	uint64_t start = stats_start();
+
 	if (!mem)
 		return;
-	if (munmap(mem->base, mem->mapped_size) == -1) {
+
+	if (mem->window) {
+		mem->window->refs--;
+		mem->window->last_use = ++cache.clock;
+		mem->window = NULL;
+		map_cache_trim(0);
+	} else if (munmap(mem->base, mem->mapped_size) == -1) {
 		perror("Can't unmap memory");
 	}
+
+	stats_account(STATS_UNMAP, start, 0);
+}
+
+/* Register style accesses of an exact width: [b]yte, [h]alfword, [w]ord, [l]ong */
+int access_size(char access_type)
+{
+	switch (access_type) {
+	case 'b':
+		return sizeof(uint8_t);
+	case 'h':
+		return sizeof(uint16_t);
+	case 'w':
+		return sizeof(uint32_t);
+	case 'l':
+		return sizeof(uint64_t);
+	default:
+		return 0;
+	}
+}
+
+uint64_t read_value(const char *ptr, char access_type)
+{
+	switch (access_type) {
+	case 'b':
+		return *(volatile uint8_t *)ptr;
+	case 'h':
+		return *(volatile uint16_t *)ptr;
+	case 'w':
+		return *(volatile uint32_t *)ptr;
+	default:
+		return *(volatile uint64_t *)ptr;
+	}
+}
+
+uint64_t write_value(char *ptr, char access_type, uint64_t val)
+{
+	switch (access_type) {
+	case 'b':
+		val &= 0xff;
+		*(volatile uint8_t *)ptr = val;
+		break;
+	case 'h':
+		val &= 0xffff;
+		*(volatile uint16_t *)ptr = val;
+		break;
+	case 'w':
+		val &= 0xffffffff;
+		*(volatile uint32_t *)ptr = val;
+		break;
+	default:
+		*(volatile uint64_t *)ptr = val;
+		break;
+	}
+
+	return val;
+}
+
+/*
+ * Bulk copies where every bus access has exactly the width of the element type.
+ * The volatile pointers stop the compiler from merging or splitting accesses,
+ * and the loop is unrolled by hand to keep the accesses back to back.
+ */
+#define COPY_WIDTH_KERNEL(type, name)                                                                                  \
+	static void copy_##name(volatile type *d, const volatile type *s, size_t n)                                    \
+	{                                                                                                              \
+		size_t i = 0;                                                                                          \
+		for (; i + 8 <= n; i += 8) {                                                                           \
+			d[i] = s[i];                                                                                   \
+			d[i + 1] = s[i + 1];                                                                           \
+			d[i + 2] = s[i + 2];                                                                           \
+			d[i + 3] = s[i + 3];                                                                           \
+			d[i + 4] = s[i + 4];                                                                           \
+			d[i + 5] = s[i + 5];                                                                           \
+			d[i + 6] = s[i + 6];                                                                           \
+			d[i + 7] = s[i + 7];                                                                           \
+		}                                                                                                      \
+		for (; i < n; i++)                                                                                     \
+			d[i] = s[i];                                                                                   \
+	}
+
+COPY_WIDTH_KERNEL(uint8_t, b)
+COPY_WIDTH_KERNEL(uint16_t, h)
+COPY_WIDTH_KERNEL(uint32_t, w)
+COPY_WIDTH_KERNEL(uint64_t, l)
+
+/* len and both pointers must be aligned to the access size */
+void copy_width(char *dst, const char *src, size_t len, char access_type)
+{
+	stats_count(STATS_ACCESS, len);
+
+	switch (access_type) {
+	case 'b':
+		copy_b((uint8_t *)dst, (const uint8_t *)src, len);
+		break;
+	case 'h':
+		copy_h((uint16_t *)dst, (const uint16_t *)src, len / sizeof(uint16_t));
+		break;
+	case 'w':
+		copy_w((uint32_t *)dst, (const uint32_t *)src, len / sizeof(uint32_t));
+		break;
+	default:
+		copy_l((uint64_t *)dst, (const uint64_t *)src, len / sizeof(uint64_t));
+		break;
+	}
+}
+
+/* Store the low element bytes of val at p in host byte order, p needs no alignment */
+void store_element(char *p, int element, uint64_t val)
+{
+	uint8_t b = val;
+	uint16_t h = val;
+	uint32_t w = val;
+
+	switch (element) {
+	case 1:
+		memcpy(p, &b, sizeof(b));
+		break;
+	case 2:
+		memcpy(p, &h, sizeof(h));
+		break;
+	case 4:
+		memcpy(p, &w, sizeof(w));
+		break;
+	default:
+		memcpy(p, &val, sizeof(val));
+		break;
+	}
+}
+
+/* Check that a range can be accessed with the given width only */
+bool width_aligned(off_t addr, off_t len, char access_type)
+{
+	int size = access_size(access_type);
+
+	return !(addr % size) && !(len % size);
+}
+
+ssize_t read_full(int fd, void *buf, size_t count)
+{
+	uint64_t start = stats_start();
+	char *p = buf;
+	size_t done = 0;
+
+	while (done < count) {
+		ssize_t ret = read(fd, p + done, count - done);
+
+		if (ret == -1) {
+			if (errno == EINTR)
+				continue;
+			return -1;
+		}
+		if (!ret)
+			break;
+		done += ret;
+	}
+
+	stats_account(STATS_READ, start, done);
+
+	return done;
+}
+
+ssize_t write_full(int fd, const void *buf, size_t count)
+{
+	uint64_t start = stats_start();
+	const char *p = buf;
+	size_t done = 0;
+
+	/* write() moves at most ~2GB per call, and less on pipes */
+	while (done < count) {
+		ssize_t ret = write(fd, p + done, count - done);
+
+		if (ret == -1) {
+			if (errno == EINTR)
+				continue;
+			return -1;
+		}
+		done += ret;
+	}
+
+	stats_account(STATS_WRITE, start, done);
+
+	return done;
+}
+
+uint64_t get_time_ns(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+
+	return (uint64_t)ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+/* Physical memory blocks are listed in sysfs together with their NUMA node */
+static int numa_node_of(off_t phys)
+{
+	char path[PATH_MAX];
+	unsigned long long block_size;
+	struct dirent *entry;
+	int node = -1;
+	FILE *f;
+	DIR *dir;
+
+	f = fopen("/sys/devices/system/memory/block_size_bytes", "r");
+	if (!f)
+		return -1;
+	if (fscanf(f, "%llx", &block_size) != 1 || !block_size) {
+		fclose(f);
+		return -1;
+	}
+	fclose(f);
+
+	snprintf(path, sizeof(path), "/sys/devices/system/memory/memory%llu", (unsigned long long)phys / block_size);
+	dir = opendir(path);
+	if (!dir)
+		return -1;
+
+	while ((entry = readdir(dir)))
+		if (sscanf(entry->d_name, "node%d", &node) == 1)
+			break;
+	closedir(dir);
+
+	return node;
+}
+
+static void pin_to_node(int node)
+{
+	char path[PATH_MAX];
+	cpu_set_t set;
+	int first, last;
+	FILE *f;
+
+	snprintf(path, sizeof(path), "/sys/devices/system/node/node%d/cpulist", node);
+	f = fopen(path, "r");
+	if (!f)
+		return;
+
+	/* cpulist looks like "0-7,16-23" */
+	CPU_ZERO(&set);
+	while (fscanf(f, "%d", &first) == 1) {
+		last = first;
+		if (fscanf(f, "-%d", &last) != 1)
+			last = first;
+		for (; first <= last && first < CPU_SETSIZE; first++)
+			CPU_SET(first, &set);
+		if (fgetc(f) != ',')
+			break;
+	}
+	fclose(f);
+
+	if (CPU_COUNT(&set))
+		pthread_setaffinity_np(pthread_self(), sizeof(set), &set);
+}
+
+struct shard_worker {
+	pthread_t thread;
+	struct shard shard;
+	shard_func func;
+	void *arg;
+	int node;
+	int rc;
+};
+
+static void *shard_thread(void *arg)
+{
+	struct shard_worker *worker = arg;
+
+	if (worker->node >= 0)
+		pin_to_node(worker->node);
+	worker->rc = worker->func(&worker->shard, worker->arg);
+
+	return NULL;
+}
+
+int auto_thread_count(off_t size)
+{
+	long cpus = sysconf(_SC_NPROCESSORS_ONLN);
+	off_t threads = size / MIN_SHARD_SIZE;
+
+	if (cpus < 1)
+		cpus = 1;
+	if (threads > cpus)
+		threads = cpus;
+
+	return threads > 0 ? threads : 1;
+}
+
+struct parallel_job {
+	int count;
+	int next;
+	int rc;
+	int (*func)(int index, void *arg);
+	void *arg;
+};
+
+static void *parallel_thread(void *arg)
+{
+	struct parallel_job *job = arg;
+	int index;
+
+	while ((index = __atomic_fetch_add(&job->next, 1, __ATOMIC_RELAXED)) < job->count) {
+		int rc = job->func(index, job->arg);
+
+		if (rc)
+			__atomic_store_n(&job->rc, rc, __ATOMIC_RELAXED);
+	}
+
+	return NULL;
+}
+
+/*
+ * Call func for every index in [0, count) from up to threads threads (0 picks
+ * the number of CPUs), handing out the next index to whichever thread is free.
+ * Returns a non zero value returned by func, or -1 if no thread could start.
+ */
+int run_parallel(int count, int threads, int (*func)(int index, void *arg), void *arg)
+{
+	struct parallel_job job = {.count = count, .func = func, .arg = arg};
+	pthread_t *workers;
+	int started = 0;
+
+	if (threads <= 0)
+		threads = sysconf(_SC_NPROCESSORS_ONLN);
+	if (threads > count)
+		threads = count;
+
+	if (threads <= 1) {
+		parallel_thread(&job);
+		return job.rc;
+	}
+
+	workers = calloc(threads, sizeof(*workers));
+	if (!workers)
+		return -1;
+
+	for (; started < threads; started++)
+		if (pthread_create(&workers[started], NULL, parallel_thread, &job))
+			break;
+	if (!started) {
+		free(workers);
+		return -1;
+	}
+
+	for (int i = 0; i < started; i++)
+		pthread_join(workers[i], NULL);
+	free(workers);
+
+	return job.rc;
+}
+
+/*
+ * Split [base, base + size) into page aligned shards and hand each of them to
+ * func on its own thread. With numa set every worker is pinned to the CPUs of
+ * the node owning the start of its shard. Returns the first non zero value
+ * returned by func, or -1 if threads could not be started.
+ */
+int run_sharded(off_t base, off_t size, int threads, bool numa, shard_func func, void *arg)
+{
+	off_t page_size = sysconf(_SC_PAGESIZE);
+	struct shard_worker *workers;
+	off_t chunk, offset = 0;
+	int i, count = 0, rc = 0;
+
+	if (threads <= 0)
+		threads = auto_thread_count(size);
+
+	if (threads == 1) {
+		struct shard shard = {.offset = 0, .len = size, .index = 0};
+
+		return func(&shard, arg);
+	}
+
+	workers = calloc(threads, sizeof(*workers));
+	if (!workers)
+		return -1;
+
+	chunk = (size + threads - 1) / threads;
+	for (i = 0; i < threads && offset < size; i++) {
+		struct shard_worker *worker = &workers[i];
+		off_t end = base + offset + chunk;
+
+		/* Cut on the page boundaries of the target address space */
+		end = (end + page_size - 1) & ~(page_size - 1);
+		if (end - base > size || i == threads - 1)
+			end = base + size;
+
+		worker->shard.offset = offset;
+		worker->shard.len = end - base - offset;
+		worker->shard.index = i;
+		worker->func = func;
+		worker->arg = arg;
+		worker->node = numa ? numa_node_of(base + offset) : -1;
+
+		if (pthread_create(&worker->thread, NULL, shard_thread, worker)) {
+			rc = -1;
+			break;
+		}
+		count++;
+		offset = end - base;
+	}
+
+	for (i = 0; i < count; i++) {
+		pthread_join(workers[i].thread, NULL);
+		if (!rc)
+			rc = workers[i].rc;
+	}
+	free(workers);
+
+	return rc;
 }
@@ -15,12 +15,119 @@
 
 #include "mem.h"
 
+#define DEFAULT_GAP 16
+
+static void print_diff(off_t source, off_t target, off_t offset, off_t len)
+{
+	printf("Difference at offset 0x%jx (0x%jx vs 0x%jx), %jd bytes\n", (intmax_t)offset,
+	       (intmax_t)(source + offset), (intmax_t)(target + offset), (intmax_t)len);
+}
+
+/*
+ * Walk both ranges and report every differing [offset, length] range. Ranges
+ * separated by no more than gap equal bytes are reported as one. Returns the
+ * number of ranges reported.
+ */
+static off_t compare_ranges(const char *a, const char *b, off_t size, off_t source, off_t target, off_t gap,
+                            off_t max_diffs)
+{
+	off_t start = -1, end = 0, pos = 0;
+	off_t diffs = 0;
+
+	while (pos < size) {
+		off_t limit = size;
+		off_t diff, same;
+
+		/* The last range to report can only grow by a difference within gap of its end */
+		if (start >= 0 && diffs + 1 == max_diffs && end + gap + 1 < size)
+			limit = end + gap + 1;
+
+		diff = pos + mem_scan(a + pos, b + pos, limit - pos, false);
+		if (diff >= limit)
+			break;
+		same = diff + mem_scan(a + diff, b + diff, size - diff, true);
+
+		if (start >= 0 && diff - end <= gap) {
+			end = same;
+		} else {
+			if (start >= 0) {
+				print_diff(source, target, start, end - start);
+				if (++diffs == max_diffs)
+					return diffs;
+			}
+			start = diff;
+			end = same;
+		}
+		pos = same;
+	}
+
+	if (start >= 0) {
+		print_diff(source, target, start, end - start);
+		diffs++;
+	}
+
+	return diffs;
+}
+
+/* Compare every range of a range list with the data a range container holds for it */
+static int compare_container(const char *list_path, char *memdev, const char *path, off_t gap, off_t max_diffs)
+{
+	struct range_container *container;
+	struct range_list list;
+	char label[32];
+	int differ = 0;
+	int rc = EXIT_SUCCESS;
+
+	if (range_list_load(list_path, &list))
+		return EXIT_FAILURE;
+
+	container = range_container_open(path);
+	if (!container || range_list_map(&list, memdev, PROT_READ)) {
+		range_container_close(container);
+		range_list_free(&list);
+		return EXIT_FAILURE;
+	}
+
+	for (int i = 0; i < list.count; i++) {
+		const struct mem_range *r = &list.ranges[i];
+		struct mapped_mem saved;
+		int ret = range_container_map(container, r, &saved);
+
+		if (ret) {
+			if (ret > 0)
+				fprintf(stderr, "Range %s is not in %s\n", range_label(r, label, sizeof(label)), path);
+			rc = EXIT_FAILURE;
+			continue;
+		}
+
+		if (compare_ranges(r->data, saved.v_ptr, r->length, r->address, r->address, gap, max_diffs)) {
+			printf("Range %s differs\n", range_label(r, label, sizeof(label)));
+			differ++;
+		}
+		unmap_memory(&saved);
+	}
+
+	if (differ)
+		printf("%d of %d ranges differ !\n", differ, list.count);
+
+	range_container_close(container);
+	range_list_free(&list);
+
+	return differ ? EXIT_FAILURE : rc;
+}
+
 static void do_compare_help(FILE *output)
 {
-	fprintf(output, "Usage:\nmem compare [options] <source address> <target address> <size>\n\n");
-	fprintf(output, "Binary compare two memory regions.\n");
+	fprintf(output, "Usage:\nmem compare [options] <source address> <target address> <size>\n");
+	fprintf(output, "       mem compare [options] --ranges <range_list> <container_file>\n\n");
+	fprintf(output, "Binary compare two memory regions, or memory ranges with their copy in a container\n");
+	fprintf(output, "written by mem store --ranges.\n");
 	fprintf(output, "Options:\n");
 	fprintf(output, " -m, --mem-dev\t\t memory device to use (default is /dev/mem)\n");
+	fprintf(output, " -f, --first\t\t Stop after the first differing range\n");
+	fprintf(output, " -d, --max-diffs\t Stop after reporting this many differing ranges\n");
+	fprintf(output, " -g, --gap\t\t Merge differing ranges at most this many bytes apart (default is 16)\n");
+	fprintf(output, " -r, --ranges\t\t compare every \"<address> <length> [name]\" line of <range_list>\n");
 	fprintf(output, " -h, --help\t\t Display this help screen\n");
 	fprintf(output, "Arguments:\n");
 	fprintf(output, " <source address> can be given in decimal, hexedecimal or octal format\n");
@@ -35,8 +142,11 @@ int do_compare(int argc, char **argv)
 	off_t source;
 	off_t target;
 	off_t size;
-	int rc;
+	off_t max_diffs = 0;
+	off_t gap = DEFAULT_GAP;
+	off_t diffs;
 	char *memdev = "/dev/mem";
+	char *ranges = NULL;
 	struct mapped_mem src_mem;
 	struct mapped_mem dst_mem;
 
@@ -44,13 +154,17 @@ int do_compare(int argc, char **argv)
 		// clang-format off
 		static struct option long_options[] = {
 			{"mem-dev", required_argument, 0, 'm'},
+			{"first", no_argument, 0, 'f'},
+			{"max-diffs", required_argument, 0, 'd'},
+			{"gap", required_argument, 0, 'g'},
+			{"ranges", required_argument, 0, 'r'},
 			{"help", no_argument, 0, 'h'},
 			{0, 0, 0, 0}
 		};
 		// clang-format on
 		int option_index = 0;
 
-		c = getopt_long(argc, argv, "m:h", long_options, &option_index);
+		c = getopt_long(argc, argv, "m:fd:g:r:h", long_options, &option_index);
 
 		/* Detect the end of the options. */
 		if (c == -1)
@@ -60,6 +174,24 @@ int do_compare(int argc, char **argv)
 		case 'm':
 			memdev = optarg;
 			break;
+		case 'f':
+			max_diffs = 1;
+			break;
+		case 'd':
+			if (parse_input(optarg, &max_diffs)) {
+				do_compare_help(stderr);
+				return EXIT_FAILURE;
+			}
+			break;
+		case 'g':
+			if (parse_input(optarg, &gap)) {
+				do_compare_help(stderr);
+				return EXIT_FAILURE;
+			}
+			break;
+		case 'r':
+			ranges = optarg;
+			break;
 		case 'h':
 			do_compare_help(stdout);
 			return EXIT_SUCCESS;
@@ -74,6 +206,15 @@ int do_compare(int argc, char **argv)
 		}
 	};
 
+	if (ranges) {
+		if (argc - optind != 1) {
+			fprintf(stderr, "Missing container file\n");
+			do_compare_help(stderr);
+			return EXIT_FAILURE;
+		}
+		return compare_container(ranges, memdev, argv[optind], gap, max_diffs);
+	}
+
 	if (argc - optind != 3) {
 		fprintf(stderr, "Missing address or size\n");
 		do_compare_help(stderr);
@@ -82,32 +223,34 @@ int do_compare(int argc, char **argv)
 
 	if (parse_input(argv[optind], &source)) {
 		do_compare_help(stderr);
-		exit(EXIT_FAILURE);
+		return EXIT_FAILURE;
 	}
 
 	if (parse_input(argv[optind + 1], &target)) {
 		do_compare_help(stderr);
-		exit(EXIT_FAILURE);
+		return EXIT_FAILURE;
 	}
 
 	if (parse_input(argv[optind + 2], &size)) {
 		do_compare_help(stderr);
-		exit(EXIT_FAILURE);
+		return EXIT_FAILURE;
 	}
 
 	if (map_memory(memdev, size, PROT_READ, source, &src_mem))
-		exit(EXIT_FAILURE);
+		return EXIT_FAILURE;
 
-	if (map_memory(memdev, size, PROT_READ, target, &dst_mem))
-		exit(EXIT_FAILURE);
+	if (map_memory(memdev, size, PROT_READ, target, &dst_mem)) {
+		unmap_memory(&src_mem);
+		return EXIT_FAILURE;
+	}
 
-	rc = memcmp(src_mem.v_ptr, dst_mem.v_ptr, size);
+	diffs = compare_ranges(src_mem.v_ptr, dst_mem.v_ptr, size, source, target, gap, max_diffs);
 
-	if (rc)
+	if (diffs)
 		printf("The memory contents differ !\n");
 
 	unmap_memory(&src_mem);
 	unmap_memory(&dst_mem);
 
-	return rc;
+	return diffs ? EXIT_FAILURE : EXIT_SUCCESS;
 }
@@ -15,12 +15,34 @@
 
 #include "mem.h"
 
+struct copy_job {
+	char *dst;
+	const char *src;
+	char width;
+};
+
+static int copy_shard(const struct shard *shard, void *arg)
+{
+	struct copy_job *job = arg;
+
+	if (job->width)
+		copy_width(job->dst + shard->offset, job->src + shard->offset, shard->len, job->width);
+	else
+		memcpy(job->dst + shard->offset, job->src + shard->offset, shard->len);
+
+	return 0;
+}
+
 static void do_copy_help(FILE *output)
 {
 	fprintf(output, "Usage:\nmem copy [options] <source address> <target address> <size>\n\n");
 	fprintf(output, "copy <size> bytes from <source address> to <target address>.\n");
 	fprintf(output, "Options:\n");
 	fprintf(output, " -m, --mem-dev\t\t memory device to use (default is /dev/mem)\n");
+	fprintf(output, " -t, --threads\t\t number of copy threads (default is 0, automatic)\n");
+	fprintf(output, " -n, --numa\t\t pin each thread to the NUMA node owning its range\n");
+	fprintf(output, " -W, --width\t\t access the memory only with [b]yte, [h]alfword, [w]ord or [l]ong accesses\n");
+	fprintf(output, " -v, --verbose\t\t Report the achieved throughput\n");
 	fprintf(output, " -h, --help\t\t Display this help screen\n");
 	fprintf(output, "Arguments:\n");
 	fprintf(output, " <source address> can be given in decimal, hexedecimal or octal format\n");
@@ -35,22 +57,30 @@ int do_copy(int argc, char **argv)
 	off_t source;
 	off_t target;
 	off_t size;
-	int rc;
+	off_t threads = 0;
+	bool numa = false;
+	bool verbose = false;
+	uint64_t start, elapsed;
 	char *memdev = "/dev/mem";
 	struct mapped_mem src_mem;
 	struct mapped_mem dst_mem;
+	struct copy_job job = {0};
 
 	while (1) {
 		// clang-format off
 		static struct option long_options[] = {
 			{"mem-dev", required_argument, 0, 'm'},
+			{"threads", required_argument, 0, 't'},
+			{"numa", no_argument, 0, 'n'},
+			{"width", required_argument, 0, 'W'},
+			{"verbose", no_argument, 0, 'v'},
 			{"help", no_argument, 0, 'h'},
 			{0, 0, 0, 0}
 		};
 		// clang-format on
 		int option_index = 0;
 
-		c = getopt_long(argc, argv, "m:h", long_options, &option_index);
+		c = getopt_long(argc, argv, "m:t:nW:vh", long_options, &option_index);
 
 		/* Detect the end of the options. */
 		if (c == -1)
@@ -60,6 +90,25 @@ int do_copy(int argc, char **argv)
 		case 'm':
 			memdev = optarg;
 			break;
+		case 't':
+			if (parse_input(optarg, &threads)) {
+				do_copy_help(stderr);
+				return EXIT_FAILURE;
+			}
+			break;
+		case 'n':
+			numa = true;
+			break;
+		case 'W':
+			job.width = tolower(*optarg);
+			if (!access_size(job.width)) {
+				fprintf(stderr, "Unsupported access width %s\n", optarg);
+				return EXIT_FAILURE;
+			}
+			break;
+		case 'v':
+			verbose = true;
+			break;
 		case 'h':
 			do_copy_help(stdout);
 			return EXIT_SUCCESS;
@@ -82,28 +131,72 @@ int do_copy(int argc, char **argv)
 
 	if (parse_input(argv[optind], &source)) {
 		do_copy_help(stderr);
-		exit(EXIT_FAILURE);
+		return EXIT_FAILURE;
 	}
 
 	if (parse_input(argv[optind + 1], &target)) {
 		do_copy_help(stderr);
-		exit(EXIT_FAILURE);
+		return EXIT_FAILURE;
 	}
 
 	if (parse_input(argv[optind + 2], &size)) {
 		do_copy_help(stderr);
-		exit(EXIT_FAILURE);
+		return EXIT_FAILURE;
+	}
+
+	if (job.width && !(width_aligned(source, size, job.width) && width_aligned(target, size, job.width))) {
+		fprintf(stderr, "Addresses and size must be aligned to the access width\n");
+		return EXIT_FAILURE;
 	}
 
-	if (map_memory(memdev, size, PROT_READ, source, &src_mem))
-		exit(EXIT_FAILURE);
+	/*
+	 * Overlapping ranges go through a single mapping so that memmove() sees
+	 * the real overlap; shards of them would race with each other.
+	 */
+	if (source < target + size && target < source + size) {
+		off_t low;
+
+		if (job.width) {
+			fprintf(stderr, "Overlapping ranges can't be copied with a fixed access width\n");
+			return EXIT_FAILURE;
+		}
+
+		low = source < target ? source : target;
+
+		if (map_memory(memdev, size + llabs(target - source), PROT_READ | PROT_WRITE, low, &dst_mem))
+			return EXIT_FAILURE;
 
-	if (map_memory(memdev, size, PROT_WRITE, target, &dst_mem))
-		exit(EXIT_FAILURE);
+		start = get_time_ns();
+		memmove(dst_mem.v_ptr + (target - low), dst_mem.v_ptr + (source - low), size);
+		src_mem.base = NULL;
+	} else {
+		if (map_memory(memdev, size, PROT_READ, source, &src_mem))
+			return EXIT_FAILURE;
+
+		if (map_memory(memdev, size, PROT_WRITE, target, &dst_mem)) {
+			unmap_memory(&src_mem);
+			return EXIT_FAILURE;
+		}
+
+		start = get_time_ns();
+		job.dst = dst_mem.v_ptr;
+		job.src = src_mem.v_ptr;
+		/* Shards are cut on page boundaries so they stay aligned to the width */
+		if (run_sharded(target, size, threads, numa, copy_shard, &job)) {
+			fprintf(stderr, "Failed to start copy threads\n");
+			unmap_memory(&src_mem);
+			unmap_memory(&dst_mem);
+			return EXIT_FAILURE;
+		}
+	}
 
-	memcpy(dst_mem.v_ptr, src_mem.v_ptr, size);
+	elapsed = get_time_ns() - start;
+	if (verbose)
+		fprintf(stderr, "Copied %jd bytes in %.3f s (%.2f GB/s)\n", (intmax_t)size, elapsed / 1e9,
+		        elapsed ? (double)size / elapsed : 0.0);
 
-	unmap_memory(&src_mem);
+	if (src_mem.base)
+		unmap_memory(&src_mem);
 	unmap_memory(&dst_mem);
 
 	return EXIT_SUCCESS;
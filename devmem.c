@@ -1,4 +1,5 @@
 #include <ctype.h>
+#include <errno.h>
 #include <fcntl.h>
 #include <getopt.h>
 #include <inttypes.h>
@@ -17,29 +18,146 @@
 
 static void do_devmem_help(FILE *output)
 {
-	fprintf(output, "Usage:\nmem devmem [options] <address> [type [data]]\n\n");
+	fprintf(output, "Usage:\nmem devmem [options] <address> [type [data]]\n");
+	fprintf(output, "       mem devmem [options] --batch <script>\n\n");
 	fprintf(output, "devmem memory content in output file.\n");
 	fprintf(output, "Options:\n");
 	fprintf(output, " -m, --mem-dev\t\t memory device to use (default is /dev/mem)\n");
 	fprintf(output, " -r, --read-back\t\t Read back data after write\n");
 	fprintf(output, " -f, --force-strict-alignment\t\t If address is not aligned, go back until it aligned (default behaviour in devmem2)\n");
 	fprintf(output, " -v, --verbose\t\t Output addresses and written values\n");
+	fprintf(output, " -b, --batch\t\t Run the accesses listed in <script> (- for stdin)\n");
 	fprintf(output, " -h, --help\t\t Display this help screen\n");
 	fprintf(output, "Arguments:\n");
 	fprintf(output, " <address> can be given in decimal, hexedecimal or octal format\n");
 	fprintf(output, " [type] access operation type: [b]yte, [h]alfword, [w]ord, [l]ong\n");
 	fprintf(output, " [data] data to be written\n\n");
+	fprintf(output, "Batch script, one access per line ('#' starts a comment):\n");
+	fprintf(output, " r <address> <type>\t\t\t read\n");
+	fprintf(output, " w <address> <type> <data>\t\t write\n");
+	fprintf(output, " m <address> <type> <data> <mask>\t read-modify-write of the bits set in <mask>\n\n");
 	fprintf(output, "Note: base is detect according to the prefix (no-prefix, 0x, and 0).\n");
 }
 
 #define READ_OP 0
 #define WRITE_OP 1
+#define RMW_OP 2
 
 static inline off_t apply_alignment(off_t addr, size_t size)
 {
 	return addr & ~(size - 1);
 }
 
+/* Parse a whole batch data or mask field, in any base strtoull() takes */
+static int parse_value(const char *str, uint64_t *val)
+{
+	char *end;
+
+	errno = 0;
+	*val = strtoull(str, &end, 0);
+
+	return errno || end == str || *end ? -1 : 0;
+}
+
+/*
+ * Execute every access of a batch script in order. The mapping cache keeps the
+ * memory device open and the page mappings around between accesses.
+ */
+static int run_batch(char *memdev, const char *script, bool force_align, bool read_back, bool verbose)
+{
+	struct mapped_mem mem;
+	char *line = NULL;
+	size_t line_size = 0;
+	unsigned int lineno = 0;
+	int rc = EXIT_SUCCESS;
+	FILE *in;
+
+	in = strcmp(script, "-") ? fopen(script, "r") : stdin;
+	if (!in) {
+		perror("Can't open batch script");
+		return EXIT_FAILURE;
+	}
+
+	while (getline(&line, &line_size, in) != -1) {
+		uint64_t write_val = 0, mask = ~0ULL, read_val;
+		char *field[6] = {NULL};
+		char *save = NULL;
+		off_t target;
+		char access_type;
+		char *ptr;
+		int fields;
+		int op;
+
+		lineno++;
+		line[strcspn(line, "#\n")] = '\0';
+
+		/* One more field than any access takes, so trailing garbage is caught */
+		for (fields = 0; fields < 6; fields++) {
+			field[fields] = strtok_r(fields ? NULL : line, " \t", &save);
+			if (!field[fields])
+				break;
+		}
+		if (!fields)
+			continue;
+
+		switch (tolower(field[0][0])) {
+		case 'r':
+			op = READ_OP;
+			break;
+		case 'w':
+			op = WRITE_OP;
+			break;
+		case 'm':
+			op = RMW_OP;
+			break;
+		default:
+			op = -1;
+			break;
+		}
+
+		access_type = fields >= 3 ? tolower(field[2][0]) : 0;
+		if (op == -1 || fields != (op == READ_OP ? 3 : op == WRITE_OP ? 4 : 5) || !access_size(access_type) ||
+		    parse_input(field[1], &target) || (op != READ_OP && parse_value(field[3], &write_val)) ||
+		    (op == RMW_OP && parse_value(field[4], &mask))) {
+			fprintf(stderr, "devmem: %s:%u: malformed access\n", script, lineno);
+			rc = EXIT_FAILURE;
+			break;
+		}
+
+		if (force_align)
+			target = apply_alignment(target, access_size(access_type));
+
+		if (map_memory(memdev, access_size(access_type), op == READ_OP ? PROT_READ : PROT_READ | PROT_WRITE,
+		               target, &mem)) {
+			rc = EXIT_FAILURE;
+			break;
+		}
+		ptr = mem.v_ptr;
+
+		if (op == RMW_OP)
+			write_val = (read_value(ptr, access_type) & ~mask) | (write_val & mask);
+
+		if (op != READ_OP) {
+			write_val = write_value(ptr, access_type, write_val);
+			if (verbose)
+				printf("Write at address 0x%8lx (%p): 0x%8lx\n", target, ptr, write_val);
+		}
+
+		if ((op == READ_OP) || read_back) {
+			read_val = read_value(ptr, access_type);
+			printf("Read at address 0x%8lx (%p): 0x%8lx\n", target, ptr, read_val);
+		}
+
+		unmap_memory(&mem);
+	}
+
+	free(line);
+	if (in != stdin)
+		fclose(in);
+
+	return rc;
+}
+
 int do_devmem(int argc, char **argv)
 {
 	int c;
@@ -48,7 +166,8 @@ int do_devmem(int argc, char **argv)
 	char *memdev = "/dev/mem";
 	struct mapped_mem mem;
 	bool read_back = false;
-	char access_type;
+	char access_type = 'w';
+	char *batch = NULL;
 	bool force_align = false;
 	int op = READ_OP;
 	uint64_t write_val;
@@ -61,13 +180,14 @@ int do_devmem(int argc, char **argv)
 			{"read-back", no_argument, 0, 'r'},
 			{"force-strict-alignment", no_argument, 0, 'f'},
 			{"verbose", no_argument, 0, 'v'},
+			{"batch", required_argument, 0, 'b'},
 			{"help", no_argument, 0, 'h'},
 			{0, 0, 0, 0}
 		};
 		// clang-format on
 		int option_index = 0;
 
-		c = getopt_long(argc, argv, "mrf:vh", long_options, &option_index);
+		c = getopt_long(argc, argv, "m:rfvb:h", long_options, &option_index);
 
 		/* Detect the end of the options. */
 		if (c == -1)
@@ -89,6 +209,9 @@ int do_devmem(int argc, char **argv)
 		case 'v':
 			verbose = true;
 			break;
+		case 'b':
+			batch = optarg;
+			break;
 		case '?':
 			/* getopt_long already printed an error message. */
 			return EXIT_FAILURE;
@@ -100,6 +223,15 @@ int do_devmem(int argc, char **argv)
 		}
 	};
 
+	if (batch) {
+		if (argc - optind) {
+			fprintf(stderr, "devmem: Unsupported arguments\n");
+			do_devmem_help(stderr);
+			return EXIT_FAILURE;
+		}
+		return run_batch(memdev, batch, force_align, read_back, verbose);
+	}
+
 	if ((argc - optind < 1) || (argc - optind > 3)) {
 		fprintf(stderr, "devmem: Unsupported arguments\n");
 		do_devmem_help(stderr);
@@ -108,27 +240,15 @@ int do_devmem(int argc, char **argv)
 
 	if (parse_input(argv[optind], &target)) {
 		do_devmem_help(stderr);
-		exit(EXIT_FAILURE);
+		return EXIT_FAILURE;
 	}
 
 	if (argc - optind > 1) {
 		access_type = tolower(*argv[optind + 1]);
-		switch (access_type) {
-		case 'b':
-			size = sizeof(uint8_t);
-			break;
-		case 'h':
-			size = sizeof(uint16_t);
-			break;
-		case 'w':
-			size = sizeof(uint32_t);
-			break;
-		case 'l':
-			size = sizeof(uint64_t);
-			break;
-		default:
+		size = access_size(access_type);
+		if (!size) {
 			fprintf(stderr, "devmem: Unsupported data type %c.\n", access_type);
-			exit(EXIT_FAILURE);
+			return EXIT_FAILURE;
 		}
 	}
 
@@ -139,63 +259,19 @@ int do_devmem(int argc, char **argv)
 		target = apply_alignment(target, size);
 
 	if (map_memory(memdev, size, (op == WRITE_OP) ? PROT_WRITE : PROT_READ, target, &mem))
-		exit(EXIT_FAILURE);
+		return EXIT_FAILURE;
 
 	if (op == WRITE_OP) {
-		write_val = strtoul(argv[optind + 2], 0, 0);
-
-		switch (access_type) {
-		case 'b':
-			write_val &= 0xff;
-			*(uint8_t *)mem.v_ptr = write_val;
-			break;
-		case 'h':
-			write_val &= 0xffff;
-			*(uint16_t *)mem.v_ptr = write_val;
-			break;
-		case 'w':
-			write_val &= 0xffffffff;
-			*(uint32_t *)mem.v_ptr = write_val;
-			break;
-		case 'l':
-			*(uint64_t *)mem.v_ptr = write_val;
-			break;
-		default:
-			fprintf(stderr, "devmem: Unsupported data type %c.\n", access_type);
-			exit(EXIT_FAILURE);
-		}
+		write_val = write_value(mem.v_ptr, access_type, strtoul(argv[optind + 2], 0, 0));
 		if (verbose)
-				printf("Write at address 0x%8lx (%p): 0x%8lx\n", target, mem.v_ptr, write_val);
+			printf("Write at address 0x%8lx (%p): 0x%8lx\n", target, mem.v_ptr, write_val);
 	}
 
 	if ((op == READ_OP) || read_back) {
-		switch (access_type) {
-		case 'b':
-			read_val = *(uint8_t *)mem.v_ptr;
-			read_val &= 0xff;
-			break;
-		case 'h':
-			read_val = *(uint16_t *)mem.v_ptr;
-			read_val &= 0xffff;
-			break;
-		case 'w':
-			read_val = *(uint32_t *)mem.v_ptr;
-			read_val &= 0xffffffff;
-			break;
-		case 'l':
-			read_val = *(uint64_t *)mem.v_ptr;
-			break;
-		default:
-			fprintf(stderr, "devmem: Unsupported data type %c.\n", access_type);
-			exit(EXIT_FAILURE);
-		}
-
+		read_val = read_value(mem.v_ptr, access_type);
 		printf("Read at address 0x%8lx (%p): 0x%8lx\n", target, mem.v_ptr, read_val);
-
 	}
 
-
-
 	unmap_memory(&mem);
 
 	return EXIT_SUCCESS;
@@ -14,34 +14,601 @@
 
 #include "mem.h"
 
+#if defined(__x86_64__) || defined(__i386__)
+#include <immintrin.h>
+#define HAVE_X86_SIMD 1
+#endif
+
+#define OUT_BUF_SIZE (1024 * 1024)
+/* Longest line: 16 digit address, 16 hex bytes and the canonical ASCII column */
+#define MAX_LINE_LEN 128
+/* Longest JSON range name once escaped, plus the fixed part of the object */
+#define MAX_HEADER_LEN 256
+
+enum dump_format {
+	DUMP_HEX,
+	DUMP_RAW,
+	DUMP_JSON,
+	DUMP_CSV,
+};
+
+struct dump_style {
+	enum dump_format format;
+	/* Bytes per value, the classic byte dump is 1 */
+	int word;
+	bool big_endian;
+	int canonical;
+	int ascii;
+	int squeeze;
+};
+
+// clang-format off
+static const struct format {
+	const char *name;
+	enum dump_format format;
+	int word;
+	} formats[] = {
+		{"hex", DUMP_HEX, 1},
+		{"u8", DUMP_HEX, 1},
+		{"u16", DUMP_HEX, 2},
+		{"u32", DUMP_HEX, 4},
+		{"u64", DUMP_HEX, 8},
+		{"raw", DUMP_RAW, 1},
+		{"json", DUMP_JSON, 1},
+		{"csv", DUMP_CSV, 1},
+		{0}
+	};
+// clang-format on
+
+struct out_buf {
+	size_t len;
+	char data[OUT_BUF_SIZE];
+};
+
+static struct out_buf out;
+
+static const char hex_digits[] = "0123456789abcdef";
+static char hex_table[256][2];
+static char graph_table[256];
+static char ascii_table[256];
+
+/*
+ * Hex digits of the 16 bytes at src into dst, value by value with the most
+ * significant byte first, so little endian values have their bytes reversed.
+ */
+static void hex_words_scalar(char *dst, const uint8_t *src, int word, bool big_endian)
+{
+	for (int i = 0; i < 16; i += word) {
+		for (int j = 0; j < word; j++) {
+			const char *hex = hex_table[src[i + (big_endian ? j : word - 1 - j)]];
+
+			*dst++ = hex[0];
+			*dst++ = hex[1];
+		}
+	}
+}
+
+#ifdef HAVE_X86_SIMD
+/* Reverse the order of the 16 bit lanes (one byte's digits each) inside every value */
+#define REVERSE_LANES(v, order) _mm_shufflehi_epi16(_mm_shufflelo_epi16(v, order), order)
+
+__attribute__((target("sse2"))) static inline __m128i hex_nibbles(__m128i n)
+{
+	__m128i letters = _mm_and_si128(_mm_cmpgt_epi8(n, _mm_set1_epi8(9)), _mm_set1_epi8('a' - '0' - 10));
+
+	return _mm_add_epi8(n, _mm_add_epi8(_mm_set1_epi8('0'), letters));
+}
+
+/* Same as hex_words_scalar(), converting all 16 bytes and swapping them in registers */
+__attribute__((target("sse2"))) static void hex_words_sse2(char *dst, const uint8_t *src, int word, bool big_endian)
+{
+	__m128i v = _mm_loadu_si128((const __m128i *)src);
+	__m128i mask = _mm_set1_epi8(0xf);
+	__m128i hi = hex_nibbles(_mm_and_si128(_mm_srli_epi16(v, 4), mask));
+	__m128i lo = hex_nibbles(_mm_and_si128(v, mask));
+	__m128i first = _mm_unpacklo_epi8(hi, lo);
+	__m128i second = _mm_unpackhi_epi8(hi, lo);
+
+	if (!big_endian) {
+		switch (word) {
+		case 2:
+			first = REVERSE_LANES(first, _MM_SHUFFLE(2, 3, 0, 1));
+			second = REVERSE_LANES(second, _MM_SHUFFLE(2, 3, 0, 1));
+			break;
+		case 4:
+			first = REVERSE_LANES(first, _MM_SHUFFLE(0, 1, 2, 3));
+			second = REVERSE_LANES(second, _MM_SHUFFLE(0, 1, 2, 3));
+			break;
+		case 8:
+			first = _mm_shuffle_epi32(REVERSE_LANES(first, _MM_SHUFFLE(0, 1, 2, 3)), _MM_SHUFFLE(1, 0, 3, 2));
+			second = _mm_shuffle_epi32(REVERSE_LANES(second, _MM_SHUFFLE(0, 1, 2, 3)), _MM_SHUFFLE(1, 0, 3, 2));
+			break;
+		}
+	}
+
+	_mm_storeu_si128((__m128i *)dst, first);
+	_mm_storeu_si128((__m128i *)(dst + 16), second);
+}
+#endif
+
+static void (*hex_words)(char *dst, const uint8_t *src, int word, bool big_endian) = hex_words_scalar;
+
+static void init_tables(void)
+{
+	for (int i = 0; i < 256; i++) {
+		hex_table[i][0] = hex_digits[i >> 4];
+		hex_table[i][1] = hex_digits[i & 0xf];
+		graph_table[i] = isgraph((char)i) ? i : '.';
+		ascii_table[i] = isascii((char)i) ? i : '.';
+	}
+
+#ifdef HAVE_X86_SIMD
+	if (__builtin_cpu_supports("sse2"))
+		hex_words = hex_words_sse2;
+#endif
+}
+
+/* The access width that reads exactly one value */
+static char word_access(int word)
+{
+	switch (word) {
+	case 2:
+		return 'h';
+	case 4:
+		return 'w';
+	case 8:
+		return 'l';
+	default:
+		return 'b';
+	}
+}
+
+static void out_flush(struct out_buf *buf)
+{
+	if (buf->len && write_full(STDOUT_FILENO, buf->data, buf->len) == -1)
+		perror("Failed writing dump output");
+	buf->len = 0;
+}
+
+static inline char *out_reserve(struct out_buf *buf, size_t len)
+{
+	if (buf->len + len > sizeof(buf->data))
+		out_flush(buf);
+
+	return buf->data + buf->len;
+}
+
+/* Same as printf("0x%.<min_digits>" PRIx64 "  ") */
+static char *format_addr(char *p, uint64_t addr, int min_digits)
+{
+	char digits[16];
+	int n = 0;
+
+	do {
+		digits[n++] = hex_digits[addr & 0xf];
+		addr >>= 4;
+	} while (addr);
+
+	*p++ = '0';
+	*p++ = 'x';
+	for (int i = n; i < min_digits; i++)
+		*p++ = '0';
+	while (n)
+		*p++ = digits[--n];
+	*p++ = ' ';
+	*p++ = ' ';
+
+	return p;
+}
+
+static char *format_line(char *p, const uint8_t *line, off_t target, off_t size, int canonical)
+{
+	p = format_addr(p, target, target >= ULONG_MAX ? 16 : 8);
+	for (int i = 0; i < 16; i++) {
+		if (i == 8)
+			*p++ = ' ';
+		*p++ = hex_table[line[i]][0];
+		*p++ = hex_table[line[i]][1];
+		*p++ = ' ';
+	}
+	if (canonical) {
+		*p++ = ' ';
+		*p++ = '|';
+		for (int i = 0; i < 16 && (size - i) > 0; i++)
+			*p++ = graph_table[line[i]];
+		*p++ = '|';
+	}
+	*p++ = '\n';
+
+	return p;
+}
+
+/* Like format_line(), with the len bytes of the line shown as values of the style's word size */
+static char *format_words(char *p, const uint8_t *line, off_t target, off_t len, const struct dump_style *style)
+{
+	char digits[32];
+
+	p = format_addr(p, target, target >= ULONG_MAX ? 16 : 8);
+	hex_words(digits, line, style->word, style->big_endian);
+	for (int i = 0; i < len; i += style->word) {
+		if (i)
+			*p++ = ' ';
+		if (i == 8)
+			*p++ = ' ';
+		/* Constant sizes so that each value is a single move */
+		switch (style->word) {
+		case 2:
+			memcpy(p, digits + 2 * i, 4);
+			break;
+		case 4:
+			memcpy(p, digits + 2 * i, 8);
+			break;
+		default:
+			memcpy(p, digits + 2 * i, 16);
+			break;
+		}
+		p += 2 * style->word;
+	}
+	if (style->canonical) {
+		*p++ = ' ';
+		*p++ = ' ';
+		*p++ = '|';
+		for (int i = 0; i < len; i++)
+			*p++ = graph_table[line[i]];
+		*p++ = '|';
+	}
+	*p++ = '\n';
+
+	return p;
+}
+
+static void dump_ascii(struct out_buf *buf, const char *virt_addr, off_t size)
+{
+	for (off_t i = 0; i < size; i++) {
+		uint8_t c = *(volatile uint8_t *)(virt_addr + i);
+
+		if (c == '\0')
+			break;
+		*out_reserve(buf, 1) = ascii_table[c];
+		buf->len++;
+	}
+	*out_reserve(buf, 1) = '\n';
+	buf->len++;
+}
+
+/*
+ * A line is squeezed when it is identical to the one following it and at
+ * least one more full line follows. Rather than comparing lines one pair at a
+ * time, compare the whole remaining range against itself shifted by a line:
+ * the first mismatching byte ends the run. Returns the number of lines to skip.
+ */
+static off_t squeezed_lines(const char *virt_addr, off_t size)
+{
+	off_t len = ((size - 32) / 16 + 1) * 16;
+
+	return mem_scan(virt_addr, virt_addr + 16, len, false) / 16;
+}
+
+/*
+ * Typed lines for register blocks. Every word is read exactly once, with an
+ * access of its size. Squeezing follows the byte dump, a line goes when it
+ * matches the full line after it, so the dump reads one line ahead and
+ * compares the copies instead of scanning the mapping a second time.
+ */
+static void dump_words(struct out_buf *buf, const char *virt_addr, off_t target, off_t size,
+                       const struct dump_style *style)
+{
+	char access = word_access(style->word);
+	bool in_squeeze = false;
+	uint8_t lines[2][16] = {{0}};
+	uint8_t *line = lines[0];
+	uint8_t *next = lines[1];
+	bool first = true;
+
+	copy_width((char *)line, virt_addr, size < 16 ? size : 16, access);
+	while (size > 0) {
+		off_t len = size < 16 ? size : 16;
+		bool squeezed = false;
+		uint8_t *tmp;
+		char *p;
+
+		if (size > 16) {
+			off_t next_len = size - 16 < 16 ? size - 16 : 16;
+
+			copy_width((char *)next, virt_addr + 16, next_len, access);
+			squeezed = style->squeeze && !first && next_len == 16 && !memcmp(line, next, 16);
+		}
+
+		if (squeezed) {
+			if (!in_squeeze) {
+				p = out_reserve(buf, 2);
+				p[0] = '*';
+				p[1] = '\n';
+				buf->len += 2;
+				in_squeeze = true;
+			}
+		} else {
+			p = out_reserve(buf, MAX_LINE_LEN);
+			buf->len = format_words(p, line, target, len, style) - buf->data;
+			in_squeeze = false;
+		}
+		tmp = line;
+		line = next;
+		next = tmp;
+		size -= 16;
+		virt_addr += 16;
+		target += 16;
+		first = false;
+	}
+}
+
+/*
+ * Render whole lines from lookup tables into a large buffer instead of going
+ * through printf() for every byte. The output is identical to the original
+ * printf() based loop, quirks included.
+ */
+static void dump_lines(struct out_buf *buf, const char *virt_addr, off_t target, off_t size,
+                       const struct dump_style *style)
+{
+	bool first = true;
+	bool in_squeeze = false;
+	uint8_t line[16] = {0};
+
+	if (style->ascii) {
+		if (size > 0)
+			dump_ascii(buf, virt_addr, size);
+		return;
+	}
+	if (style->word > 1) {
+		dump_words(buf, virt_addr, target, size, style);
+		return;
+	}
+
+	while (size > 0) {
+		char *p;
+
+		if (style->squeeze && (!first) && ((size - 16) >= 16)) {
+			off_t run = squeezed_lines(virt_addr, size);
+
+			if (run) {
+				if (!in_squeeze) {
+					p = out_reserve(buf, 2);
+					p[0] = '*';
+					p[1] = '\n';
+					buf->len += 2;
+					in_squeeze = true;
+				}
+				size -= run * 16;
+				virt_addr += run * 16;
+				target += run * 16;
+				continue;
+			} else {
+				in_squeeze = false;
+			}
+		}
+
+		for (int i = 0; i < 16; i++)
+			line[i] = *(volatile uint8_t *)(virt_addr + i);
+
+		p = out_reserve(buf, MAX_LINE_LEN);
+		buf->len = format_line(p, line, target, size, style->canonical) - buf->data;
+		size -= 16;
+		virt_addr += 16;
+		target += 16;
+		first = false;
+	}
+}
+
+/* Append the JSON string for s, quotes included */
+static char *format_json_string(char *p, const char *s)
+{
+	*p++ = '"';
+	for (; *s; s++) {
+		if (*s == '"' || *s == '\\')
+			*p++ = '\\';
+		*p++ = *s;
+	}
+	*p++ = '"';
+
+	return p;
+}
+
+/*
+ * One JSON object, or one CSV "[name,]address,value" row per value, for the
+ * size bytes at virt_addr. Values are hex strings, as 64 bit ones don't fit a
+ * JSON number.
+ */
+static void dump_values(struct out_buf *buf, const char *virt_addr, off_t target, off_t size,
+                        const struct dump_style *style, const char *name)
+{
+	int value_len = 2 * style->word;
+	bool json = style->format == DUMP_JSON;
+	uint8_t line[16] = {0};
+	char digits[32];
+	char *p;
+
+	if (json) {
+		p = out_reserve(buf, MAX_HEADER_LEN);
+		*p++ = '{';
+		if (name) {
+			p = stpcpy(p, "\"name\":");
+			p = format_json_string(p, name);
+			*p++ = ',';
+		}
+		p += sprintf(p, "\"address\":\"0x%jx\",\"word\":%d,\"big_endian\":%s,\"values\":[", (intmax_t)target,
+		             style->word, style->big_endian ? "true" : "false");
+		buf->len = p - buf->data;
+	}
+
+	for (off_t offset = 0; offset < size; offset += 16) {
+		off_t len = size - offset < 16 ? size - offset : 16;
+
+		copy_width((char *)line, virt_addr + offset, len, word_access(style->word));
+		hex_words(digits, line, style->word, style->big_endian);
+
+		for (int i = 0; i < len; i += style->word) {
+			p = out_reserve(buf, MAX_LINE_LEN);
+			if (json) {
+				if (offset || i)
+					*p++ = ',';
+				*p++ = '"';
+			} else {
+				if (name) {
+					p = stpcpy(p, name);
+					*p++ = ',';
+				}
+				/* format_addr() ends with two spaces */
+				p = format_addr(p, target + offset + i, 8) - 2;
+				*p++ = ',';
+			}
+			*p++ = '0';
+			*p++ = 'x';
+			memcpy(p, digits + 2 * i, value_len);
+			p += value_len;
+			*p++ = json ? '"' : '\n';
+			buf->len = p - buf->data;
+		}
+	}
+
+	if (json) {
+		p = out_reserve(buf, 3);
+		p = stpcpy(p, "]}\n");
+		buf->len = p - buf->data;
+	}
+}
+
+/* Dump size bytes at virt_addr (physical address target) in the requested style */
+static void dump_range(struct out_buf *buf, const char *virt_addr, off_t target, off_t size,
+                       const struct dump_style *style, const char *name)
+{
+	switch (style->format) {
+	case DUMP_RAW:
+		out_flush(buf);
+		if (write_full(STDOUT_FILENO, virt_addr, size) == -1)
+			perror("Failed writing dump output");
+		break;
+	case DUMP_JSON:
+	case DUMP_CSV:
+		dump_values(buf, virt_addr, target, size, style, name);
+		break;
+	default:
+		dump_lines(buf, virt_addr, target, size, style);
+		break;
+	}
+}
+
+static int parse_format(const char *arg, struct dump_style *style)
+{
+	const char *word = strchr(arg, ':');
+	size_t len = word ? (size_t)(word - arg) : strlen(arg);
+	const struct format *f, *w;
+
+	for (f = formats; f->name; f++)
+		if (strlen(f->name) == len && !strncmp(arg, f->name, len))
+			break;
+	if (!f->name) {
+		fprintf(stderr, "Unknown dump format %s\n", arg);
+		return -1;
+	}
+	style->format = f->format;
+	style->word = f->word;
+
+	if (!word)
+		return 0;
+
+	/* json and csv take the value size as a ":u8" to ":u64" suffix */
+	for (w = formats; w->name; w++)
+		if (w->format == DUMP_HEX && !strcmp(word + 1, w->name) && strcmp(w->name, "hex"))
+			break;
+	if (!w->name || (f->format != DUMP_JSON && f->format != DUMP_CSV)) {
+		fprintf(stderr, "Unknown dump format %s\n", arg);
+		return -1;
+	}
+	style->word = w->word;
+
+	return 0;
+}
+
 static void do_dump_help(FILE *output)
 {
-	fprintf(output, "Usage:\nmem dump [options] <address> <length>\n\n");
+	fprintf(output, "Usage:\nmem dump [options] <address> <length>\n");
+	fprintf(output, "       mem dump [options] --ranges <range_list>\n\n");
 	fprintf(output, "Display memory content in hexadecimal format.\n");
 	fprintf(output, "Options:\n");
 	fprintf(output, " -m, --mem-dev\t\t memory device to use (default is /dev/mem)\n");
 	fprintf(output, " -C, --canonical\t canonical hex+ASCII display\n");
 	fprintf(output, " -a, --ascii\t\t ASCII display\n");
-	fprintf(output, " -v, --no-squeezing\t output identical lines\n\n");
+	fprintf(output, " -v, --no-squeezing\t output identical lines\n");
+	fprintf(output, " -f, --format\t\t hex (default), u16, u32 or u64 values read with accesses of their size,\n");
+	fprintf(output, "\t\t\t raw binary, or json and csv with an optional :u16, :u32 or :u64 value size\n");
+	fprintf(output, " -B, --big-endian\t show values wider than a byte as big endian (default is little)\n");
+	fprintf(output, " -r, --ranges\t\t dump every \"<address> <length> [name]\" line of <range_list>\n\n");
 	fprintf(output, " -h, --help\t\t Display this help screen\n");
 	fprintf(output, "Arguments:\n");
 	fprintf(output, " <address> and <length> can be given in decimal, hexedecimal or octal format\n");
 	fprintf(output, " depending of the prefix (no-prefix, 0x, and 0).\n");
 }
 
+/*
+ * Dump every range of a range list in address order, each under a "name:"
+ * header in the hex formats and named by its label in JSON and CSV.
+ */
+static int dump_ranges(const char *list_path, char *memdev, const struct dump_style *style)
+{
+	struct range_list list;
+	char label[32];
+
+	if (range_list_load(list_path, &list))
+		return EXIT_FAILURE;
+	for (int i = 0; style->word > 1 && !style->ascii && i < list.count; i++) {
+		if (!width_aligned(list.ranges[i].address, list.ranges[i].length, word_access(style->word))) {
+			fprintf(stderr, "%s: range %s isn't aligned to the %d byte value size\n", list_path,
+			        range_label(&list.ranges[i], label, sizeof(label)), style->word);
+			range_list_free(&list);
+			return EXIT_FAILURE;
+		}
+	}
+	if (range_list_map(&list, memdev, PROT_READ)) {
+		range_list_free(&list);
+		return EXIT_FAILURE;
+	}
+
+	out.len = 0;
+	if (style->format == DUMP_CSV)
+		out.len = stpcpy(out.data, "range,address,value\n") - out.data;
+
+	for (int i = 0; i < list.count; i++) {
+		const struct mem_range *r = &list.ranges[i];
+		const char *name = range_label(r, label, sizeof(label));
+		size_t len = strlen(name);
+
+		if (style->format == DUMP_HEX) {
+			char *p = out_reserve(&out, len + 2);
+
+			memcpy(p, name, len);
+			p[len] = ':';
+			p[len + 1] = '\n';
+			out.len += len + 2;
+		}
+		dump_range(&out, r->data, r->address, r->length, style, name);
+	}
+	out_flush(&out);
+
+	range_list_free(&list);
+
+	return EXIT_SUCCESS;
+}
+
 int do_dump(int argc, char **argv)
 {
 	int c;
-	int canonical = 0;
-	void *virt_addr;
-	int ascii = 0;
-	int squeeze = 1;
+	struct dump_style style = {.format = DUMP_HEX, .word = 1, .squeeze = 1};
 	off_t target;
 	off_t size;
-	bool first = true;
-	bool in_squeeze = false;
 	char *memdev = "/dev/mem";
+	char *ranges = NULL;
 	struct mapped_mem mem;
+
 	while (1) {
 		// clang-format off
 		static struct option long_options[] = {
@@ -49,13 +616,16 @@ int do_dump(int argc, char **argv)
 		    {"canonical", no_argument, 0, 'C'},
 		    {"no-squeezing", no_argument, 0, 'v'},
 		    {"ascii", no_argument, 0, 'a'},
+		    {"ranges", required_argument, 0, 'r'},
+		    {"format", required_argument, 0, 'f'},
+		    {"big-endian", no_argument, 0, 'B'},
 		    {"help", no_argument, 0, 'h'},
 		    {0, 0, 0, 0}
 		};
 		// clang-format on
 		int option_index = 0;
 
-		c = getopt_long(argc, argv, "m:Cvha", long_options, &option_index);
+		c = getopt_long(argc, argv, "m:Cvhar:f:B", long_options, &option_index);
 
 		/* Detect the end of the options. */
 		if (c == -1)
@@ -66,13 +636,23 @@ int do_dump(int argc, char **argv)
 			memdev = optarg;
 			break;
 		case 'C':
-			canonical = 1;
+			style.canonical = 1;
 			break;
 		case 'a':
-			ascii = 1;
+			style.ascii = 1;
+			break;
+		case 'r':
+			ranges = optarg;
 			break;
 		case 'v':
-			squeeze = 0;
+			style.squeeze = 0;
+			break;
+		case 'f':
+			if (parse_format(optarg, &style))
+				return EXIT_FAILURE;
+			break;
+		case 'B':
+			style.big_endian = true;
 			break;
 		case 'h':
 			do_dump_help(stdout);
@@ -87,6 +667,26 @@ int do_dump(int argc, char **argv)
 			break;
 		}
 	};
+	if (style.canonical && style.ascii) {
+		fprintf(stderr, "Ascii & Canonical are mutual exclusive options\n");
+		return EXIT_FAILURE;
+	}
+	if ((style.canonical || style.ascii) && style.format != DUMP_HEX) {
+		fprintf(stderr, "Ascii & Canonical only apply to the hex formats\n");
+		return EXIT_FAILURE;
+	}
+
+	init_tables();
+
+	if (ranges) {
+		if (argc - optind != 0) {
+			fprintf(stderr, "Unexpected arguments with a range list\n");
+			do_dump_help(stderr);
+			return EXIT_FAILURE;
+		}
+		return dump_ranges(ranges, memdev, &style);
+	}
+
 	if (argc - optind != 2) {
 		fprintf(stderr, "Missing address or length\n");
 		do_dump_help(stderr);
@@ -95,80 +695,29 @@ int do_dump(int argc, char **argv)
 
 	if (parse_input(argv[optind], &target)) {
 		do_dump_help(stderr);
-		exit(EXIT_FAILURE);
+		return EXIT_FAILURE;
 	}
 
 	if (parse_input(argv[optind + 1], &size)) {
 		do_dump_help(stderr);
-		exit(EXIT_FAILURE);
+		return EXIT_FAILURE;
 	}
 
-	if (canonical && ascii) {
-		fprintf(stderr, "Ascii & Canonical are mutual exclusive options\n");
+	if (style.word > 1 && !style.ascii && !width_aligned(target, size, word_access(style.word))) {
+		fprintf(stderr, "Address and length must be multiples of the %d byte value size\n", style.word);
 		return EXIT_FAILURE;
 	}
+
 	/* Get address */
 
 	if (map_memory(memdev, size, PROT_READ, target, &mem))
-		exit(EXIT_FAILURE);
-
-	virt_addr = mem.v_ptr;
-
-	// Do the magic here
-	while (size > 0) {
-		int i;
-
-		if (!ascii) {
-			if (squeeze && (!first) && ((size - 16) >= 16)) {
-				if (memcmp(virt_addr, virt_addr + 16, 16) == 0) {
-					if (!in_squeeze) {
-						printf("*\n");
-						in_squeeze = true;
-					}
-					goto proceed;
-				} else {
-					in_squeeze = false;
-				}
-			}
+		return EXIT_FAILURE;
 
-			if (target >= ULONG_MAX)
-				printf("0x%.16" PRIx64 "  ", target);
-			else
-				printf("0x%.8" PRIx64 "  ", target);
-			for (i = 0; i < 16; i++) {
-				if (i == 8)
-					putchar(' ');
-				printf("%02x ", *(volatile uint8_t *)(virt_addr + i));
-			}
-			if (canonical) {
-				printf(" |");
-				for (i = 0; i < 16 && (size - i) > 0; i++) {
-					char c = *(volatile uint8_t *)(virt_addr + i);
-					printf("%c", isgraph(c) ? c : '.');
-				}
-				printf("|");
-			}
-		} else {
-			for (i = 0; i < size; i++) {
-				char c = *(volatile uint8_t *)(virt_addr + i);
-				if (c == '\0')
-					break;
-				if (isascii(c))
-					putchar(c);
-				else
-					putchar('.');
-			}
-			putchar('\n');
-			goto exit1;
-		}
-		putchar('\n');
-proceed:
-		size -= 16;
-		virt_addr += 16;
-		target += 16;
-		first = false;
-	}
-exit1:
+	out.len = 0;
+	if (style.format == DUMP_CSV)
+		out.len = stpcpy(out.data, "address,value\n") - out.data;
+	dump_range(&out, mem.v_ptr, target, size, &style, NULL);
+	out_flush(&out);
 
 	unmap_memory(&mem);
 
@@ -0,0 +1,422 @@
+#include <ctype.h>
+#include <getopt.h>
+#include <inttypes.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/types.h>
+#include <unistd.h>
+
+#include "mem.h"
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <immintrin.h>
+#define HAVE_X86_SIMD 1
+#endif
+
+/* Staging buffer for fills that can't be streamed straight to memory */
+#define FILL_BUF_SIZE 4096
+
+enum fill_mode {
+	FILL_CONSTANT,
+	FILL_INCREMENT,
+	FILL_RANDOM,
+};
+
+struct fill_result {
+	off_t mismatches;
+	off_t first;
+};
+
+struct fill_job {
+	char *dst;
+	enum fill_mode mode;
+	/* Constant value, first value of an increment or the random seed */
+	uint64_t pattern;
+	int element;
+	char width;
+	bool cached;
+	struct fill_result *results;
+};
+
+static uint64_t splitmix64(uint64_t x)
+{
+	x += 0x9e3779b97f4a7c15ULL;
+	x = (x ^ (x >> 30)) * 0xbf58476d1ce4e5b9ULL;
+	x = (x ^ (x >> 27)) * 0x94d049bb133111ebULL;
+
+	return x ^ (x >> 31);
+}
+
+/*
+ * The pattern is defined in 64-bit words relative to the start of the range,
+ * so every byte can be regenerated from its offset alone, independently of
+ * how the range was sharded.
+ */
+static void fill_word(const struct fill_job *job, off_t offset, char *out)
+{
+	int i;
+
+	switch (job->mode) {
+	case FILL_CONSTANT:
+		for (i = 0; i < 8; i += job->element)
+			store_element(out + i, job->element, job->pattern);
+		break;
+	case FILL_INCREMENT:
+		for (i = 0; i < 8; i += job->element)
+			store_element(out + i, job->element, job->pattern + (offset + i) / job->element);
+		break;
+	case FILL_RANDOM:
+		store_element(out, 8, splitmix64(job->pattern + offset / 8));
+		break;
+	}
+}
+
+/* Generate the 16 bytes of pattern found at offset */
+static void fill_chunk(const struct fill_job *job, off_t offset, char *out)
+{
+	off_t skew = offset & 7;
+	char words[24];
+
+	if (!skew) {
+		fill_word(job, offset, out);
+		fill_word(job, offset + 8, out + 8);
+		return;
+	}
+
+	for (int i = 0; i < 3; i++)
+		fill_word(job, offset - skew + i * 8, words + i * 8);
+	memcpy(out, words + skew, 16);
+}
+
+/* Generate the pattern for [offset, end) into a buffer and copy it out */
+static void fill_buffered(const struct fill_job *job, off_t offset, off_t end)
+{
+	char buf[FILL_BUF_SIZE] __attribute__((aligned(16)));
+
+	while (offset < end) {
+		off_t len = end - offset < FILL_BUF_SIZE ? end - offset : FILL_BUF_SIZE;
+
+		for (off_t i = 0; i < len; i += 16)
+			fill_chunk(job, offset + i, buf + i);
+
+		if (job->width)
+			copy_width(job->dst + offset, buf, len, job->width);
+		else
+			memcpy(job->dst + offset, buf, len);
+		offset += len;
+	}
+}
+
+#ifdef HAVE_X86_SIMD
+/*
+ * Non-temporal stores bypass the caches, so filling a large range doesn't
+ * evict everything else the system was working on.
+ */
+__attribute__((target("sse2"))) static void fill_stream(const struct fill_job *job, off_t offset, off_t end)
+{
+	off_t head = (16 - ((uintptr_t)(job->dst + offset) & 15)) & 15;
+	char chunk[16];
+	__m128i v;
+
+	if (head > end - offset)
+		head = end - offset;
+	fill_buffered(job, offset, offset + head);
+	offset += head;
+
+	/* A constant pattern repeats every 8 bytes, whatever the offset */
+	fill_chunk(job, offset, chunk);
+	v = _mm_loadu_si128((const __m128i *)chunk);
+
+	for (; offset + 16 <= end; offset += 16) {
+		if (job->mode != FILL_CONSTANT) {
+			fill_chunk(job, offset, chunk);
+			v = _mm_loadu_si128((const __m128i *)chunk);
+		}
+		_mm_stream_si128((__m128i *)(job->dst + offset), v);
+	}
+	_mm_sfence();
+
+	fill_buffered(job, offset, end);
+}
+#endif
+
+static int fill_shard(const struct shard *shard, void *arg)
+{
+	struct fill_job *job = arg;
+	off_t end = shard->offset + shard->len;
+
+#ifdef HAVE_X86_SIMD
+	if (!job->cached && !job->width) {
+		fill_stream(job, shard->offset, end);
+		return 0;
+	}
+#endif
+	fill_buffered(job, shard->offset, end);
+
+	return 0;
+}
+
+static int verify_shard(const struct shard *shard, void *arg)
+{
+	struct fill_job *job = arg;
+	struct fill_result *result = &job->results[shard->index];
+	char expected[FILL_BUF_SIZE];
+	char actual[FILL_BUF_SIZE];
+	off_t offset = shard->offset;
+	off_t end = shard->offset + shard->len;
+
+	result->first = -1;
+	while (offset < end) {
+		off_t len = end - offset < FILL_BUF_SIZE ? end - offset : FILL_BUF_SIZE;
+		const char *got = job->dst + offset;
+
+		for (off_t i = 0; i < len; i += 16)
+			fill_chunk(job, offset + i, expected + i);
+
+		if (job->width) {
+			copy_width(actual, got, len, job->width);
+			got = actual;
+		}
+
+		for (off_t i = mem_scan(got, expected, len, false); i < len; i++) {
+			if (got[i] == expected[i])
+				continue;
+			if (result->first < 0)
+				result->first = offset + i;
+			result->mismatches++;
+		}
+		offset += len;
+	}
+
+	return 0;
+}
+
+static void do_fill_help(FILE *output)
+{
+	fprintf(output, "Usage:\nmem fill [options] <address> <size> [pattern]\n\n");
+	fprintf(output, "fill <size> bytes at <address> with [pattern] (default is 0).\n");
+	fprintf(output, "Options:\n");
+	fprintf(output, " -m, --mem-dev\t\t memory device to use (default is /dev/mem)\n");
+	fprintf(output, " -e, --element\t\t pattern element size: [b]yte, [h]alfword, [w]ord or [l]ong (default is b)\n");
+	fprintf(output, " -i, --increment\t increment the pattern by one for every element\n");
+	fprintf(output, " -r, --random\t\t fill with pseudo random data generated from the given seed\n");
+	fprintf(output, " -t, --threads\t\t number of fill threads (default is 0, automatic)\n");
+	fprintf(output, " -n, --numa\t\t pin each thread to the NUMA node owning its range\n");
+	fprintf(output, " -W, --width\t\t access the memory only with [b]yte, [h]alfword, [w]ord or [l]ong accesses\n");
+	fprintf(output, " -c, --cached\t\t use regular stores instead of non-temporal ones\n");
+	fprintf(output, " -V, --verify\t\t read the range back and check it against the pattern\n");
+	fprintf(output, " -v, --verbose\t\t Report the achieved throughput\n");
+	fprintf(output, " -h, --help\t\t Display this help screen\n");
+	fprintf(output, "Arguments:\n");
+	fprintf(output, " <address> can be given in decimal, hexedecimal or octal format\n");
+	fprintf(output, " <size> can be given in decimal, hexedecimal or octal format\n");
+	fprintf(output, " [pattern] can be given in decimal, hexedecimal or octal format\n");
+	fprintf(output, "Note: base is detect according to the prefix (no-prefix, 0x, and 0).\n");
+}
+
+int do_fill(int argc, char **argv)
+{
+	int c;
+	off_t target;
+	off_t size;
+	off_t pattern = 0;
+	off_t seed = 0;
+	off_t threads = 0;
+	off_t mismatches = 0;
+	off_t first = -1;
+	bool numa = false;
+	bool random = false;
+	bool increment = false;
+	bool verify = false;
+	bool verbose = false;
+	uint64_t start, elapsed;
+	char *memdev = "/dev/mem";
+	struct mapped_mem mem;
+	struct fill_job job = {.element = 1};
+
+	while (1) {
+		// clang-format off
+		static struct option long_options[] = {
+			{"mem-dev", required_argument, 0, 'm'},
+			{"element", required_argument, 0, 'e'},
+			{"increment", no_argument, 0, 'i'},
+			{"random", required_argument, 0, 'r'},
+			{"threads", required_argument, 0, 't'},
+			{"numa", no_argument, 0, 'n'},
+			{"width", required_argument, 0, 'W'},
+			{"cached", no_argument, 0, 'c'},
+			{"verify", no_argument, 0, 'V'},
+			{"verbose", no_argument, 0, 'v'},
+			{"help", no_argument, 0, 'h'},
+			{0, 0, 0, 0}
+		};
+		// clang-format on
+		int option_index = 0;
+
+		c = getopt_long(argc, argv, "m:e:ir:t:nW:cVvh", long_options, &option_index);
+
+		/* Detect the end of the options. */
+		if (c == -1)
+			break;
+
+		switch (c) {
+		case 'm':
+			memdev = optarg;
+			break;
+		case 'e':
+			job.element = access_size(tolower(*optarg));
+			if (!job.element) {
+				fprintf(stderr, "Unsupported element size %s\n", optarg);
+				return EXIT_FAILURE;
+			}
+			break;
+		case 'i':
+			increment = true;
+			break;
+		case 'r':
+			random = true;
+			if (parse_input(optarg, &seed)) {
+				do_fill_help(stderr);
+				return EXIT_FAILURE;
+			}
+			break;
+		case 't':
+			if (parse_input(optarg, &threads)) {
+				do_fill_help(stderr);
+				return EXIT_FAILURE;
+			}
+			break;
+		case 'n':
+			numa = true;
+			break;
+		case 'W':
+			job.width = tolower(*optarg);
+			if (!access_size(job.width)) {
+				fprintf(stderr, "Unsupported access width %s\n", optarg);
+				return EXIT_FAILURE;
+			}
+			break;
+		case 'c':
+			job.cached = true;
+			break;
+		case 'V':
+			verify = true;
+			break;
+		case 'v':
+			verbose = true;
+			break;
+		case 'h':
+			do_fill_help(stdout);
+			return EXIT_SUCCESS;
+		case '?':
+			/* getopt_long already printed an error message. */
+			return EXIT_FAILURE;
+		default:
+			fprintf(stderr, "Unsupported option\n");
+			do_fill_help(stderr);
+			return EXIT_FAILURE;
+			break;
+		}
+	};
+
+	if (argc - optind < 2 || argc - optind > 3) {
+		fprintf(stderr, "Missing address or size\n");
+		do_fill_help(stderr);
+		return EXIT_FAILURE;
+	}
+
+	if (parse_input(argv[optind], &target)) {
+		do_fill_help(stderr);
+		return EXIT_FAILURE;
+	}
+
+	if (parse_input(argv[optind + 1], &size)) {
+		do_fill_help(stderr);
+		return EXIT_FAILURE;
+	}
+
+	if (argc - optind == 3 && parse_input(argv[optind + 2], &pattern)) {
+		do_fill_help(stderr);
+		return EXIT_FAILURE;
+	}
+
+	if (random && (increment || argc - optind == 3)) {
+		fprintf(stderr, "Random fill doesn't take a pattern\n");
+		return EXIT_FAILURE;
+	}
+
+	if (job.element < 8 && (uint64_t)pattern >> (job.element * 8)) {
+		fprintf(stderr, "Pattern 0x%jx doesn't fit in a %d byte element\n", (uintmax_t)pattern, job.element);
+		return EXIT_FAILURE;
+	}
+
+	if (job.width && !width_aligned(target, size, job.width)) {
+		fprintf(stderr, "Address and size must be aligned to the access width\n");
+		return EXIT_FAILURE;
+	}
+
+	job.mode = random ? FILL_RANDOM : increment ? FILL_INCREMENT : FILL_CONSTANT;
+	job.pattern = random ? (uint64_t)seed : (uint64_t)pattern;
+
+	if (map_memory(memdev, size, PROT_READ | PROT_WRITE, target, &mem))
+		return EXIT_FAILURE;
+	job.dst = mem.v_ptr;
+
+	start = get_time_ns();
+	if (run_sharded(target, size, threads, numa, fill_shard, &job)) {
+		fprintf(stderr, "Failed to start fill threads\n");
+		unmap_memory(&mem);
+		return EXIT_FAILURE;
+	}
+	elapsed = get_time_ns() - start;
+
+	if (verbose)
+		fprintf(stderr, "Filled %jd bytes in %.3f s (%.2f GB/s)\n", (intmax_t)size, elapsed / 1e9,
+		        elapsed ? (double)size / elapsed : 0.0);
+
+	if (verify) {
+		/* Every shard reports into its own slot, indexed by the shard number */
+		if (threads <= 0)
+			threads = auto_thread_count(size);
+		job.results = calloc(threads, sizeof(*job.results));
+		if (!job.results) {
+			unmap_memory(&mem);
+			return EXIT_FAILURE;
+		}
+
+		start = get_time_ns();
+		if (run_sharded(target, size, threads, numa, verify_shard, &job)) {
+			fprintf(stderr, "Failed to start verify threads\n");
+			free(job.results);
+			unmap_memory(&mem);
+			return EXIT_FAILURE;
+		}
+		elapsed = get_time_ns() - start;
+
+		for (int i = 0; i < threads; i++) {
+			mismatches += job.results[i].mismatches;
+			if (first < 0 && job.results[i].mismatches)
+				first = job.results[i].first;
+		}
+		free(job.results);
+
+		if (verbose)
+			fprintf(stderr, "Verified %jd bytes in %.3f s (%.2f GB/s)\n", (intmax_t)size, elapsed / 1e9,
+			        elapsed ? (double)size / elapsed : 0.0);
+
+		if (mismatches) {
+			fprintf(stderr, "Verify failed: %jd bytes differ, first at 0x%jx\n", (intmax_t)mismatches,
+			        (uintmax_t)(target + first));
+			unmap_memory(&mem);
+			return EXIT_FAILURE;
+		}
+	}
+
+	unmap_memory(&mem);
+
+	return EXIT_SUCCESS;
+}
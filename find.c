@@ -0,0 +1,417 @@
+#include <ctype.h>
+#include <getopt.h>
+#include <inttypes.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/types.h>
+#include <unistd.h>
+
+#include "mem.h"
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <immintrin.h>
+#define HAVE_X86_SIMD 1
+#endif
+
+/* Above this spacing visiting the candidates beats scanning every byte */
+#define FIND_SPARSE_STEP 32
+
+struct needle {
+	const char *text;
+	char *bytes;
+	/* NULL when every bit of the needle has to match */
+	char *mask;
+	size_t len;
+};
+
+struct find_job;
+
+typedef void (*find_func)(struct find_job *job, off_t pos, off_t end);
+
+struct find_job {
+	find_func find;
+	const char *mem;
+	off_t address;
+	off_t size;
+	struct needle *needles;
+	int count;
+	size_t max_len;
+	off_t align;
+	off_t stride;
+	off_t limit;
+	off_t matches;
+	bool stop;
+};
+
+static bool needle_match(const struct find_job *job, const struct needle *n, off_t pos)
+{
+	const char *p = job->mem + pos;
+
+	if (pos + (off_t)n->len > job->size)
+		return false;
+	if ((job->address + pos) % job->align || pos % job->stride)
+		return false;
+
+	if (!n->mask)
+		return !memcmp(p, n->bytes, n->len);
+
+	for (size_t i = 0; i < n->len; i++)
+		if ((p[i] ^ n->bytes[i]) & n->mask[i])
+			return false;
+
+	return true;
+}
+
+/* Matches are printed as they are found, so they come out of order when threaded */
+static void report(struct find_job *job, const struct needle *n, off_t pos)
+{
+	off_t found = __atomic_add_fetch(&job->matches, 1, __ATOMIC_RELAXED);
+
+	if (job->limit && found > job->limit) {
+		__atomic_store_n(&job->stop, true, __ATOMIC_RELAXED);
+		return;
+	}
+
+	if (job->count > 1)
+		printf("0x%jx %s\n", (uintmax_t)(job->address + pos), n->text);
+	else
+		printf("0x%jx\n", (uintmax_t)(job->address + pos));
+
+	if (job->limit && found == job->limit)
+		__atomic_store_n(&job->stop, true, __ATOMIC_RELAXED);
+}
+
+static void check_position(struct find_job *job, off_t pos)
+{
+	for (int i = 0; i < job->count; i++)
+		if (needle_match(job, &job->needles[i], pos))
+			report(job, &job->needles[i], pos);
+}
+
+static void find_scalar(struct find_job *job, off_t pos, off_t end)
+{
+	for (; pos < end; pos++) {
+		/* Filter on the first byte before comparing the whole needle */
+		for (int i = 0; i < job->count; i++) {
+			const struct needle *n = &job->needles[i];
+			char m = n->mask ? n->mask[0] : (char)0xff;
+
+			if (!((job->mem[pos] ^ n->bytes[0]) & m) && needle_match(job, n, pos))
+				report(job, n, pos);
+		}
+		if (!(pos & 4095) && __atomic_load_n(&job->stop, __ATOMIC_RELAXED))
+			return;
+	}
+}
+
+/* Only visit the positions allowed by the alignment and stride constraints */
+static void find_sparse(struct find_job *job, off_t pos, off_t end)
+{
+	off_t step = job->stride > 1 ? job->stride : job->align;
+	off_t skew = job->stride > 1 ? pos % step : (job->address + pos) % step;
+
+	if (skew)
+		pos += step - skew;
+
+	for (; pos < end && !__atomic_load_n(&job->stop, __ATOMIC_RELAXED); pos += step)
+		check_position(job, pos);
+}
+
+#ifdef HAVE_X86_SIMD
+/*
+ * Compare the (masked) first and last byte of every needle against 16 or 32
+ * positions at a time and only verify the positions where both match.
+ */
+#define FIND_KERNEL(name, isa, width, vec, load, set1, and, cmpeq, movemask)                                        \
+	__attribute__((target(isa))) static void name(struct find_job *job, off_t pos, off_t end)                   \
+	{                                                                                                              \
+		off_t last = job->size - job->max_len + 1;                                                             \
+		off_t vec_end = end < last ? end : last;                                                               \
+                                                                                                                       \
+		for (; pos + width <= vec_end; pos += width) {                                                         \
+			for (int i = 0; i < job->count; i++) {                                                         \
+				const struct needle *n = &job->needles[i];                                             \
+				char m0 = n->mask ? n->mask[0] : (char)0xff;                                           \
+				char m1 = n->mask ? n->mask[n->len - 1] : (char)0xff;                                  \
+				vec a = load((const vec *)(job->mem + pos));                                           \
+				vec b = load((const vec *)(job->mem + pos + n->len - 1));                              \
+				vec ea = cmpeq(and(a, set1(m0)), set1(n->bytes[0] & m0));                              \
+				vec eb = cmpeq(and(b, set1(m1)), set1(n->bytes[n->len - 1] & m1));                     \
+				unsigned int hits = movemask(and(ea, eb));                                             \
+                                                                                                                       \
+				while (hits) {                                                                         \
+					off_t at = pos + __builtin_ctz(hits);                                          \
+                                                                                                                       \
+					if (needle_match(job, n, at))                                                  \
+						report(job, n, at);                                                    \
+					hits &= hits - 1;                                                              \
+				}                                                                                      \
+			}                                                                                              \
+			if (!(pos & 4095) && __atomic_load_n(&job->stop, __ATOMIC_RELAXED))                            \
+				return;                                                                                \
+		}                                                                                                      \
+                                                                                                                       \
+		find_scalar(job, pos, end);                                                                            \
+	}
+
+FIND_KERNEL(find_sse2, "sse2", 16, __m128i, _mm_loadu_si128, _mm_set1_epi8, _mm_and_si128, _mm_cmpeq_epi8,
+            _mm_movemask_epi8)
+FIND_KERNEL(find_avx2, "avx2", 32, __m256i, _mm256_loadu_si256, _mm256_set1_epi8, _mm256_and_si256,
+            _mm256_cmpeq_epi8, _mm256_movemask_epi8)
+#endif
+
+static find_func select_find(void)
+{
+#ifdef HAVE_X86_SIMD
+	__builtin_cpu_init();
+	if (__builtin_cpu_supports("avx2"))
+		return find_avx2;
+	if (__builtin_cpu_supports("sse2"))
+		return find_sse2;
+#endif
+	return find_scalar;
+}
+
+static int find_shard(const struct shard *shard, void *arg)
+{
+	struct find_job *job = arg;
+	off_t end = shard->offset + shard->len;
+
+	if (job->stride * job->align >= FIND_SPARSE_STEP) {
+		find_sparse(job, shard->offset, end);
+		return 0;
+	}
+
+	job->find(job, shard->offset, end);
+
+	return 0;
+}
+
+static int parse_needle(struct needle *n, const char *text, bool string, int element, const off_t *mask)
+{
+	off_t val;
+
+	n->text = text;
+	if (string) {
+		n->len = strlen(text);
+		if (!n->len) {
+			fprintf(stderr, "Empty pattern\n");
+			return -1;
+		}
+		n->bytes = strdup(text);
+		return n->bytes ? 0 : -1;
+	}
+
+	if (parse_input(text, &val))
+		return -1;
+	if (element < 8 && (uint64_t)val >> (element * 8)) {
+		fprintf(stderr, "Pattern %s doesn't fit in a %d byte element\n", text, element);
+		return -1;
+	}
+
+	n->len = element;
+	n->bytes = malloc(element);
+	if (!n->bytes)
+		return -1;
+	store_element(n->bytes, element, val);
+
+	if (mask) {
+		n->mask = malloc(element);
+		if (!n->mask)
+			return -1;
+		store_element(n->mask, element, *mask);
+	}
+
+	return 0;
+}
+
+static void free_needles(struct needle *needles, int count)
+{
+	for (int i = 0; i < count; i++) {
+		free(needles[i].bytes);
+		free(needles[i].mask);
+	}
+	free(needles);
+}
+
+static void do_find_help(FILE *output)
+{
+	fprintf(output, "Usage:\nmem find [options] <address> <size> <pattern>...\n\n");
+	fprintf(output, "Print the addresses where any of the patterns is found.\n");
+	fprintf(output, "Options:\n");
+	fprintf(output, " -m, --mem-dev\t\t memory device to use (default is /dev/mem)\n");
+	fprintf(output, " -e, --element\t\t pattern size: [b]yte, [h]alfword, [w]ord or [l]ong (default is w)\n");
+	fprintf(output, " -s, --string\t\t patterns are strings instead of values\n");
+	fprintf(output, " -M, --mask\t\t only compare the bits set in the mask\n");
+	fprintf(output, " -a, --align\t\t only report matches at addresses aligned to this many bytes\n");
+	fprintf(output, " -S, --stride\t\t only look every <stride> bytes from <address>\n");
+	fprintf(output, " -l, --limit\t\t stop after this many matches\n");
+	fprintf(output, " -t, --threads\t\t number of search threads (default is 0, automatic)\n");
+	fprintf(output, " -h, --help\t\t Display this help screen\n");
+	fprintf(output, "Arguments:\n");
+	fprintf(output, " <address> can be given in decimal, hexedecimal or octal format\n");
+	fprintf(output, " <size> can be given in decimal, hexedecimal or octal format\n");
+	fprintf(output, " <pattern> can be given in decimal, hexedecimal or octal format\n");
+	fprintf(output, "Note: base is detect according to the prefix (no-prefix, 0x, and 0).\n");
+	fprintf(output, "Returns 0 if a match was found, 1 otherwise.\n");
+}
+
+int do_find(int argc, char **argv)
+{
+	int c;
+	off_t target;
+	off_t size;
+	off_t mask;
+	off_t threads = 0;
+	bool has_mask = false;
+	bool string = false;
+	int element = 4;
+	char *memdev = "/dev/mem";
+	struct mapped_mem mem;
+	struct find_job job = {.align = 1, .stride = 1};
+
+	while (1) {
+		// clang-format off
+		static struct option long_options[] = {
+			{"mem-dev", required_argument, 0, 'm'},
+			{"element", required_argument, 0, 'e'},
+			{"string", no_argument, 0, 's'},
+			{"mask", required_argument, 0, 'M'},
+			{"align", required_argument, 0, 'a'},
+			{"stride", required_argument, 0, 'S'},
+			{"limit", required_argument, 0, 'l'},
+			{"threads", required_argument, 0, 't'},
+			{"help", no_argument, 0, 'h'},
+			{0, 0, 0, 0}
+		};
+		// clang-format on
+		int option_index = 0;
+
+		c = getopt_long(argc, argv, "m:e:sM:a:S:l:t:h", long_options, &option_index);
+
+		/* Detect the end of the options. */
+		if (c == -1)
+			break;
+
+		switch (c) {
+		case 'm':
+			memdev = optarg;
+			break;
+		case 'e':
+			element = access_size(tolower(*optarg));
+			if (!element) {
+				fprintf(stderr, "Unsupported element size %s\n", optarg);
+				return EXIT_FAILURE;
+			}
+			break;
+		case 's':
+			string = true;
+			break;
+		case 'M':
+			has_mask = true;
+			if (parse_input(optarg, &mask)) {
+				do_find_help(stderr);
+				return EXIT_FAILURE;
+			}
+			break;
+		case 'a':
+		case 'S':
+			if (parse_input(optarg, c == 'a' ? &job.align : &job.stride)) {
+				do_find_help(stderr);
+				return EXIT_FAILURE;
+			}
+			break;
+		case 'l':
+			if (parse_input(optarg, &job.limit)) {
+				do_find_help(stderr);
+				return EXIT_FAILURE;
+			}
+			break;
+		case 't':
+			if (parse_input(optarg, &threads)) {
+				do_find_help(stderr);
+				return EXIT_FAILURE;
+			}
+			break;
+		case 'h':
+			do_find_help(stdout);
+			return EXIT_SUCCESS;
+		case '?':
+			/* getopt_long already printed an error message. */
+			return EXIT_FAILURE;
+		default:
+			fprintf(stderr, "Unsupported option\n");
+			do_find_help(stderr);
+			return EXIT_FAILURE;
+			break;
+		}
+	};
+
+	if (argc - optind < 3) {
+		fprintf(stderr, "Missing address, size or pattern\n");
+		do_find_help(stderr);
+		return EXIT_FAILURE;
+	}
+
+	if (parse_input(argv[optind], &target)) {
+		do_find_help(stderr);
+		return EXIT_FAILURE;
+	}
+
+	if (parse_input(argv[optind + 1], &size)) {
+		do_find_help(stderr);
+		return EXIT_FAILURE;
+	}
+
+	if (job.align < 1 || job.stride < 1) {
+		fprintf(stderr, "Alignment and stride must be at least 1\n");
+		return EXIT_FAILURE;
+	}
+
+	if (string && has_mask) {
+		fprintf(stderr, "String patterns can't be masked\n");
+		return EXIT_FAILURE;
+	}
+
+	if (has_mask && element < 8 && (uint64_t)mask >> (element * 8)) {
+		fprintf(stderr, "Mask doesn't fit in a %d byte element\n", element);
+		return EXIT_FAILURE;
+	}
+
+	job.count = argc - optind - 2;
+	job.needles = calloc(job.count, sizeof(*job.needles));
+	if (!job.needles)
+		return EXIT_FAILURE;
+
+	for (int i = 0; i < job.count; i++) {
+		struct needle *n = &job.needles[i];
+
+		if (parse_needle(n, argv[optind + 2 + i], string, element, has_mask ? &mask : NULL)) {
+			free_needles(job.needles, job.count);
+			return EXIT_FAILURE;
+		}
+		if (n->len > job.max_len)
+			job.max_len = n->len;
+	}
+
+	if (map_memory(memdev, size, PROT_READ, target, &mem)) {
+		free_needles(job.needles, job.count);
+		return EXIT_FAILURE;
+	}
+
+	job.find = select_find();
+	job.mem = mem.v_ptr;
+	job.address = target;
+	job.size = size;
+	if (run_sharded(target, size, threads, false, find_shard, &job))
+		fprintf(stderr, "Failed to start search threads\n");
+
+	unmap_memory(&mem);
+	free_needles(job.needles, job.count);
+
+	return job.matches ? EXIT_SUCCESS : EXIT_FAILURE;
+}
@@ -0,0 +1,722 @@
+#include <ctype.h>
+#include <getopt.h>
+#include <inttypes.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <unistd.h>
+
+#include "mem.h"
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <immintrin.h>
+#define HAVE_X86_CRC 1
+#elif defined(__aarch64__)
+#include <arm_acle.h>
+#include <sys/auxv.h>
+#define HAVE_ARM_CRC 1
+#ifndef HWCAP_CRC32
+#define HWCAP_CRC32 (1 << 7)
+#endif
+#endif
+
+#define DEFAULT_CHUNK_SIZE (64 * 1024 * 1024)
+
+#define HASH_CRC32C 0x1
+#define HASH_XXH64  0x2
+#define HASH_SHA256 0x4
+
+struct chunk_digest {
+	uint32_t crc32c;
+	uint64_t xxh64;
+	uint8_t sha256[32];
+};
+
+/* CRC32C (Castagnoli), reflected polynomial */
+#define CRC32C_POLY 0x82f63b78
+
+static uint32_t crc32c_table[256];
+
+static void crc32c_init_table(void)
+{
+	for (uint32_t i = 0; i < 256; i++) {
+		uint32_t crc = i;
+
+		for (int j = 0; j < 8; j++)
+			crc = (crc >> 1) ^ (crc & 1 ? CRC32C_POLY : 0);
+		crc32c_table[i] = crc;
+	}
+}
+
+static uint32_t crc32c_sw(uint32_t crc, const uint8_t *p, size_t len)
+{
+	while (len--)
+		crc = crc32c_table[(crc ^ *p++) & 0xff] ^ (crc >> 8);
+
+	return crc;
+}
+
+#ifdef HAVE_X86_CRC
+__attribute__((target("sse4.2"))) static uint32_t crc32c_hw(uint32_t crc, const uint8_t *p, size_t len)
+{
+#ifdef __x86_64__
+	uint64_t crc64 = crc;
+
+	for (; len >= 8; len -= 8, p += 8) {
+		uint64_t v;
+
+		memcpy(&v, p, sizeof(v));
+		crc64 = _mm_crc32_u64(crc64, v);
+	}
+	crc = crc64;
+#endif
+	for (; len >= 4; len -= 4, p += 4) {
+		uint32_t v;
+
+		memcpy(&v, p, sizeof(v));
+		crc = _mm_crc32_u32(crc, v);
+	}
+	while (len--)
+		crc = _mm_crc32_u8(crc, *p++);
+
+	return crc;
+}
+
+static bool crc32c_hw_supported(void)
+{
+	__builtin_cpu_init();
+	return __builtin_cpu_supports("sse4.2");
+}
+#elif defined(HAVE_ARM_CRC)
+__attribute__((target("+crc"))) static uint32_t crc32c_hw(uint32_t crc, const uint8_t *p, size_t len)
+{
+	for (; len >= 8; len -= 8, p += 8) {
+		uint64_t v;
+
+		memcpy(&v, p, sizeof(v));
+		crc = __crc32cd(crc, v);
+	}
+	while (len--)
+		crc = __crc32cb(crc, *p++);
+
+	return crc;
+}
+
+static bool crc32c_hw_supported(void)
+{
+	return getauxval(AT_HWCAP) & HWCAP_CRC32;
+}
+#else
+static bool crc32c_hw_supported(void)
+{
+	return false;
+}
+#endif
+
+static uint32_t (*crc32c_update)(uint32_t crc, const uint8_t *p, size_t len) = crc32c_sw;
+
+static uint32_t crc32c(const uint8_t *p, size_t len)
+{
+	return ~crc32c_update(~0U, p, len);
+}
+
+/*
+ * CRC of the concatenation of two blocks from their CRCs and the length of
+ * the second one, by applying len2 zero bytes to crc1 in GF(2) (as in zlib).
+ */
+static uint32_t gf2_matrix_times(const uint32_t *mat, uint32_t vec)
+{
+	uint32_t sum = 0;
+
+	for (; vec; vec >>= 1, mat++)
+		if (vec & 1)
+			sum ^= *mat;
+
+	return sum;
+}
+
+static void gf2_matrix_square(uint32_t *square, const uint32_t *mat)
+{
+	for (int n = 0; n < 32; n++)
+		square[n] = gf2_matrix_times(mat, mat[n]);
+}
+
+static uint32_t crc32c_combine(uint32_t crc1, uint32_t crc2, uint64_t len2)
+{
+	uint32_t even[32], odd[32];
+	uint32_t row = 1;
+
+	if (!len2)
+		return crc1;
+
+	/* Operator for a single zero bit */
+	odd[0] = CRC32C_POLY;
+	for (int n = 1; n < 32; n++) {
+		odd[n] = row;
+		row <<= 1;
+	}
+	gf2_matrix_square(even, odd); /* two zero bits */
+	gf2_matrix_square(odd, even); /* four zero bits */
+
+	do {
+		gf2_matrix_square(even, odd);
+		if (len2 & 1)
+			crc1 = gf2_matrix_times(even, crc1);
+		len2 >>= 1;
+		if (!len2)
+			break;
+		gf2_matrix_square(odd, even);
+		if (len2 & 1)
+			crc1 = gf2_matrix_times(odd, crc1);
+		len2 >>= 1;
+	} while (len2);
+
+	return crc1 ^ crc2;
+}
+
+/* xxHash64 */
+#define XXH_PRIME64_1 0x9e3779b185ebca87ULL
+#define XXH_PRIME64_2 0xc2b2ae3d27d4eb4fULL
+#define XXH_PRIME64_3 0x165667b19e3779f9ULL
+#define XXH_PRIME64_4 0x85ebca77c2b2ae63ULL
+#define XXH_PRIME64_5 0x27d4eb2f165667c5ULL
+
+static inline uint64_t rotl64(uint64_t x, int r)
+{
+	return (x << r) | (x >> (64 - r));
+}
+
+static inline uint64_t read64(const uint8_t *p)
+{
+	uint64_t v;
+
+	memcpy(&v, p, sizeof(v));
+	return v;
+}
+
+static inline uint32_t read32(const uint8_t *p)
+{
+	uint32_t v;
+
+	memcpy(&v, p, sizeof(v));
+	return v;
+}
+
+static inline uint64_t xxh64_round(uint64_t acc, uint64_t input)
+{
+	acc += input * XXH_PRIME64_2;
+	acc = rotl64(acc, 31);
+	return acc * XXH_PRIME64_1;
+}
+
+static inline uint64_t xxh64_merge_round(uint64_t acc, uint64_t val)
+{
+	acc ^= xxh64_round(0, val);
+	return acc * XXH_PRIME64_1 + XXH_PRIME64_4;
+}
+
+static uint64_t xxh64(const uint8_t *p, size_t len, uint64_t seed)
+{
+	const uint8_t *end = p + len;
+	uint64_t h;
+
+	if (len >= 32) {
+		uint64_t v1 = seed + XXH_PRIME64_1 + XXH_PRIME64_2;
+		uint64_t v2 = seed + XXH_PRIME64_2;
+		uint64_t v3 = seed;
+		uint64_t v4 = seed - XXH_PRIME64_1;
+
+		for (; p + 32 <= end; p += 32) {
+			v1 = xxh64_round(v1, read64(p));
+			v2 = xxh64_round(v2, read64(p + 8));
+			v3 = xxh64_round(v3, read64(p + 16));
+			v4 = xxh64_round(v4, read64(p + 24));
+		}
+		h = rotl64(v1, 1) + rotl64(v2, 7) + rotl64(v3, 12) + rotl64(v4, 18);
+		h = xxh64_merge_round(h, v1);
+		h = xxh64_merge_round(h, v2);
+		h = xxh64_merge_round(h, v3);
+		h = xxh64_merge_round(h, v4);
+	} else {
+		h = seed + XXH_PRIME64_5;
+	}
+
+	h += len;
+
+	for (; p + 8 <= end; p += 8) {
+		h ^= xxh64_round(0, read64(p));
+		h = rotl64(h, 27) * XXH_PRIME64_1 + XXH_PRIME64_4;
+	}
+	if (p + 4 <= end) {
+		h ^= (uint64_t)read32(p) * XXH_PRIME64_1;
+		h = rotl64(h, 23) * XXH_PRIME64_2 + XXH_PRIME64_3;
+		p += 4;
+	}
+	for (; p < end; p++) {
+		h ^= *p * XXH_PRIME64_5;
+		h = rotl64(h, 11) * XXH_PRIME64_1;
+	}
+
+	h ^= h >> 33;
+	h *= XXH_PRIME64_2;
+	h ^= h >> 29;
+	h *= XXH_PRIME64_3;
+	h ^= h >> 32;
+
+	return h;
+}
+
+/* SHA-256 (FIPS 180-4) */
+static const uint32_t sha256_k[64] = {
+	0x428a2f98, 0x71374491, 0xb5c0fbcf, 0xe9b5dba5, 0x3956c25b, 0x59f111f1, 0x923f82a4, 0xab1c5ed5,
+	0xd807aa98, 0x12835b01, 0x243185be, 0x550c7dc3, 0x72be5d74, 0x80deb1fe, 0x9bdc06a7, 0xc19bf174,
+	0xe49b69c1, 0xefbe4786, 0x0fc19dc6, 0x240ca1cc, 0x2de92c6f, 0x4a7484aa, 0x5cb0a9dc, 0x76f988da,
+	0x983e5152, 0xa831c66d, 0xb00327c8, 0xbf597fc7, 0xc6e00bf3, 0xd5a79147, 0x06ca6351, 0x14292967,
+	0x27b70a85, 0x2e1b2138, 0x4d2c6dfc, 0x53380d13, 0x650a7354, 0x766a0abb, 0x81c2c92e, 0x92722c85,
+	0xa2bfe8a1, 0xa81a664b, 0xc24b8b70, 0xc76c51a3, 0xd192e819, 0xd6990624, 0xf40e3585, 0x106aa070,
+	0x19a4c116, 0x1e376c08, 0x2748774c, 0x34b0bcb5, 0x391c0cb3, 0x4ed8aa4a, 0x5b9cca4f, 0x682e6ff3,
+	0x748f82ee, 0x78a5636f, 0x84c87814, 0x8cc70208, 0x90befffa, 0xa4506ceb, 0xbef9a3f7, 0xc67178f2,
+};
+
+static inline uint32_t rotr32(uint32_t x, int r)
+{
+	return (x >> r) | (x << (32 - r));
+}
+
+static void sha256_block(uint32_t *state, const uint8_t *p)
+{
+	uint32_t w[64];
+	uint32_t a, b, c, d, e, f, g, h;
+
+	for (int i = 0; i < 16; i++)
+		w[i] = (uint32_t)p[4 * i] << 24 | (uint32_t)p[4 * i + 1] << 16 | (uint32_t)p[4 * i + 2] << 8 | p[4 * i + 3];
+	for (int i = 16; i < 64; i++) {
+		uint32_t s0 = rotr32(w[i - 15], 7) ^ rotr32(w[i - 15], 18) ^ (w[i - 15] >> 3);
+		uint32_t s1 = rotr32(w[i - 2], 17) ^ rotr32(w[i - 2], 19) ^ (w[i - 2] >> 10);
+
+		w[i] = w[i - 16] + s0 + w[i - 7] + s1;
+	}
+
+	a = state[0], b = state[1], c = state[2], d = state[3];
+	e = state[4], f = state[5], g = state[6], h = state[7];
+
+	for (int i = 0; i < 64; i++) {
+		uint32_t t1 = h + (rotr32(e, 6) ^ rotr32(e, 11) ^ rotr32(e, 25)) + ((e & f) ^ (~e & g)) + sha256_k[i] + w[i];
+		uint32_t t2 = (rotr32(a, 2) ^ rotr32(a, 13) ^ rotr32(a, 22)) + ((a & b) ^ (a & c) ^ (b & c));
+
+		h = g, g = f, f = e, e = d + t1;
+		d = c, c = b, b = a, a = t1 + t2;
+	}
+
+	state[0] += a, state[1] += b, state[2] += c, state[3] += d;
+	state[4] += e, state[5] += f, state[6] += g, state[7] += h;
+}
+
+void sha256(const uint8_t *p, size_t len, uint8_t *digest)
+{
+	uint32_t state[8] = {0x6a09e667, 0xbb67ae85, 0x3c6ef372, 0xa54ff53a,
+	                     0x510e527f, 0x9b05688c, 0x1f83d9ab, 0x5be0cd19};
+	uint8_t tail[128] = {0};
+	uint64_t bits = (uint64_t)len * 8;
+	size_t rest, tail_len;
+
+	for (; len >= 64; len -= 64, p += 64)
+		sha256_block(state, p);
+
+	rest = len;
+	memcpy(tail, p, rest);
+	tail[rest] = 0x80;
+	tail_len = rest + 1 + 8 <= 64 ? 64 : 128;
+	for (int i = 0; i < 8; i++)
+		tail[tail_len - 1 - i] = bits >> (8 * i);
+
+	sha256_block(state, tail);
+	if (tail_len == 128)
+		sha256_block(state, tail + 64);
+
+	for (int i = 0; i < 8; i++) {
+		digest[4 * i] = state[i] >> 24;
+		digest[4 * i + 1] = state[i] >> 16;
+		digest[4 * i + 2] = state[i] >> 8;
+		digest[4 * i + 3] = state[i];
+	}
+}
+
+struct hash_job {
+	const uint8_t *data;
+	off_t size;
+	off_t chunk_size;
+	int algos;
+	struct chunk_digest *chunks;
+};
+
+/* Every shard hashes the fixed size chunks starting inside it */
+static int hash_shard(const struct shard *shard, void *arg)
+{
+	struct hash_job *job = arg;
+	off_t first = (shard->offset + job->chunk_size - 1) / job->chunk_size;
+	off_t last = (shard->offset + shard->len + job->chunk_size - 1) / job->chunk_size;
+
+	for (off_t i = first; i < last; i++) {
+		off_t offset = i * job->chunk_size;
+		off_t len = job->size - offset < job->chunk_size ? job->size - offset : job->chunk_size;
+		const uint8_t *p = job->data + offset;
+
+		if (job->algos & HASH_CRC32C)
+			job->chunks[i].crc32c = crc32c(p, len);
+		if (job->algos & HASH_XXH64)
+			job->chunks[i].xxh64 = xxh64(p, len, 0);
+		if (job->algos & HASH_SHA256)
+			sha256(p, len, job->chunks[i].sha256);
+	}
+
+	return 0;
+}
+
+static void print_hex(const uint8_t *p, size_t len)
+{
+	for (size_t i = 0; i < len; i++)
+		printf("%02x", p[i]);
+}
+
+static void print_chunk(const struct chunk_digest *d, int algos, const char *label)
+{
+	if (algos & HASH_CRC32C)
+		printf(" %08" PRIx32, d->crc32c);
+	if (algos & HASH_XXH64)
+		printf(" %016" PRIx64, d->xxh64);
+	if (algos & HASH_SHA256) {
+		putchar(' ');
+		print_hex(d->sha256, sizeof(d->sha256));
+	}
+	if (label)
+		printf(" %s", label);
+	putchar('\n');
+}
+
+/*
+ * Fold the chunk digests into one digest per algorithm. CRC32C combines into
+ * exactly the CRC of the whole range. xxHash64 and SHA-256 can't be combined,
+ * so with more than one chunk they are a hash over the big endian list of
+ * chunk digests, which only depends on the chunk size, never on the threads.
+ * Returns -1, leaving *total unusable, if the list can't be allocated.
+ */
+static int combine_chunks(const struct hash_job *job, off_t count, struct chunk_digest *total)
+{
+	uint8_t *list;
+
+	*total = job->chunks[0];
+	if (count == 1)
+		return 0;
+
+	for (off_t i = 1; i < count; i++) {
+		off_t len = job->size - i * job->chunk_size < job->chunk_size ? job->size - i * job->chunk_size
+		                                                              : job->chunk_size;
+
+		total->crc32c = crc32c_combine(total->crc32c, job->chunks[i].crc32c, len);
+	}
+
+	if (!(job->algos & (HASH_XXH64 | HASH_SHA256)))
+		return 0;
+
+	list = malloc(count * sizeof(job->chunks[0].sha256));
+	if (!list)
+		return -1;
+
+	for (off_t i = 0; i < count; i++)
+		for (int j = 0; j < 8; j++)
+			list[i * 8 + j] = job->chunks[i].xxh64 >> (56 - 8 * j);
+	total->xxh64 = xxh64(list, count * 8, 0);
+
+	for (off_t i = 0; i < count; i++)
+		memcpy(list + i * sizeof(job->chunks[0].sha256), job->chunks[i].sha256, sizeof(job->chunks[0].sha256));
+	sha256(list, count * sizeof(job->chunks[0].sha256), total->sha256);
+
+	free(list);
+
+	return 0;
+}
+
+struct ranges_job {
+	const struct range_list *list;
+	int algos;
+	struct chunk_digest *digests;
+};
+
+static int hash_range(int index, void *arg)
+{
+	struct ranges_job *job = arg;
+	const struct mem_range *r = &job->list->ranges[index];
+	const uint8_t *p = (const uint8_t *)r->data;
+
+	if (job->algos & HASH_CRC32C)
+		job->digests[index].crc32c = crc32c(p, r->length);
+	if (job->algos & HASH_XXH64)
+		job->digests[index].xxh64 = xxh64(p, r->length, 0);
+	if (job->algos & HASH_SHA256)
+		sha256(p, r->length, job->digests[index].sha256);
+
+	return 0;
+}
+
+/* Print the standard digests of every range of a range list, one line per range in address order */
+static int hash_ranges(const char *list_path, char *memdev, int algos, int threads)
+{
+	struct range_list list;
+	struct ranges_job job = {.list = &list, .algos = algos};
+	char label[32];
+
+	if (range_list_load(list_path, &list))
+		return EXIT_FAILURE;
+
+	job.digests = calloc(list.count, sizeof(*job.digests));
+	if (!job.digests || range_list_map(&list, memdev, PROT_READ)) {
+		free(job.digests);
+		range_list_free(&list);
+		return EXIT_FAILURE;
+	}
+
+	if (run_parallel(list.count, threads, hash_range, &job)) {
+		fprintf(stderr, "Failed to start hashing threads\n");
+		free(job.digests);
+		range_list_free(&list);
+		return EXIT_FAILURE;
+	}
+
+	for (int i = 0; i < list.count; i++) {
+		const struct mem_range *r = &list.ranges[i];
+
+		printf("0x%08jx %jd", (intmax_t)r->address, (intmax_t)r->length);
+		print_chunk(&job.digests[i], algos, r->name ? range_label(r, label, sizeof(label)) : NULL);
+	}
+
+	free(job.digests);
+	range_list_free(&list);
+
+	return EXIT_SUCCESS;
+}
+
+static int parse_algos(const char *list)
+{
+	int algos = 0;
+	char *copy = strdup(list);
+	char *save = NULL;
+
+	if (!copy)
+		return 0;
+
+	for (char *tok = strtok_r(copy, ",", &save); tok; tok = strtok_r(NULL, ",", &save)) {
+		if (!strcmp(tok, "crc32c"))
+			algos |= HASH_CRC32C;
+		else if (!strcmp(tok, "xxh64"))
+			algos |= HASH_XXH64;
+		else if (!strcmp(tok, "sha256"))
+			algos |= HASH_SHA256;
+		else if (!strcmp(tok, "all"))
+			algos |= HASH_CRC32C | HASH_XXH64 | HASH_SHA256;
+		else {
+			fprintf(stderr, "Unknown hash algorithm %s\n", tok);
+			algos = 0;
+			break;
+		}
+	}
+	free(copy);
+
+	return algos;
+}
+
+static void do_hash_help(FILE *output)
+{
+	fprintf(output, "Usage:\nmem hash [options] <address> <size>\n");
+	fprintf(output, "       mem hash [options] --ranges <range_list>\n\n");
+	fprintf(output, "Hash a memory range straight from its mapping.\n");
+	fprintf(output, "Options:\n");
+	fprintf(output, " -m, --mem-dev\t\t memory device to use (default is /dev/mem)\n");
+	fprintf(output, " -a, --algorithms\t comma separated list of crc32c, xxh64, sha256 or all (default is sha256)\n");
+	fprintf(output, " -c, --chunk-size\t size of the independently hashed chunks (default is 64MB)\n");
+	fprintf(output, " -t, --threads\t\t number of hashing threads (default is 0, automatic)\n");
+	fprintf(output, " -M, --manifest\t\t also print the digests of every chunk\n");
+	fprintf(output, " -r, --ranges\t\t print the digests of every \"<address> <length> [name]\" line of\n");
+	fprintf(output, "\t\t\t <range_list>, hashing the ranges in parallel\n");
+	fprintf(output, " -h, --help\t\t Display this help screen\n");
+	fprintf(output, "Arguments:\n");
+	fprintf(output, " <address> and <size> can be given in decimal, hexedecimal or octal format\n");
+	fprintf(output, " depending of the prefix (no-prefix, 0x, and 0).\n");
+	fprintf(output, "Note: ranges up to one chunk give the standard digests. For larger ranges crc32c is\n");
+	fprintf(output, " still the CRC of the whole range, xxh64 and sha256 hash the list of chunk digests.\n");
+}
+
+int do_hash(int argc, char **argv)
+{
+	int c;
+	off_t target;
+	off_t size;
+	off_t chunk_size = DEFAULT_CHUNK_SIZE;
+	off_t threads = 0;
+	off_t count;
+	bool manifest = false;
+	int algos = HASH_SHA256;
+	char *memdev = "/dev/mem";
+	char *ranges = NULL;
+	struct mapped_mem mem;
+	struct hash_job job;
+	struct chunk_digest total;
+
+	while (1) {
+		// clang-format off
+		static struct option long_options[] = {
+			{"mem-dev", required_argument, 0, 'm'},
+			{"algorithms", required_argument, 0, 'a'},
+			{"chunk-size", required_argument, 0, 'c'},
+			{"threads", required_argument, 0, 't'},
+			{"manifest", no_argument, 0, 'M'},
+			{"ranges", required_argument, 0, 'r'},
+			{"help", no_argument, 0, 'h'},
+			{0, 0, 0, 0}
+		};
+		// clang-format on
+		int option_index = 0;
+
+		c = getopt_long(argc, argv, "m:a:c:t:Mr:h", long_options, &option_index);
+
+		/* Detect the end of the options. */
+		if (c == -1)
+			break;
+
+		switch (c) {
+		case 'm':
+			memdev = optarg;
+			break;
+		case 'a':
+			algos = parse_algos(optarg);
+			if (!algos)
+				return EXIT_FAILURE;
+			break;
+		case 'c':
+			if (parse_input(optarg, &chunk_size)) {
+				do_hash_help(stderr);
+				return EXIT_FAILURE;
+			}
+			break;
+		case 't':
+			if (parse_input(optarg, &threads)) {
+				do_hash_help(stderr);
+				return EXIT_FAILURE;
+			}
+			break;
+		case 'M':
+			manifest = true;
+			break;
+		case 'r':
+			ranges = optarg;
+			break;
+		case 'h':
+			do_hash_help(stdout);
+			return EXIT_SUCCESS;
+		case '?':
+			/* getopt_long already printed an error message. */
+			return EXIT_FAILURE;
+		default:
+			fprintf(stderr, "Unsupported option\n");
+			do_hash_help(stderr);
+			return EXIT_FAILURE;
+			break;
+		}
+	};
+
+	if (ranges) {
+		if (argc - optind != 0) {
+			fprintf(stderr, "Unexpected arguments with a range list\n");
+			do_hash_help(stderr);
+			return EXIT_FAILURE;
+		}
+		crc32c_init_table();
+		if (crc32c_hw_supported())
+			crc32c_update = crc32c_hw;
+		return hash_ranges(ranges, memdev, algos, threads);
+	}
+
+	if (argc - optind != 2) {
+		fprintf(stderr, "Missing address or size\n");
+		do_hash_help(stderr);
+		return EXIT_FAILURE;
+	}
+
+	if (parse_input(argv[optind], &target)) {
+		do_hash_help(stderr);
+		return EXIT_FAILURE;
+	}
+
+	if (parse_input(argv[optind + 1], &size)) {
+		do_hash_help(stderr);
+		return EXIT_FAILURE;
+	}
+
+	if (size <= 0 || chunk_size <= 0) {
+		fprintf(stderr, "Size and chunk size must be positive\n");
+		return EXIT_FAILURE;
+	}
+
+	crc32c_init_table();
+	if (crc32c_hw_supported())
+		crc32c_update = crc32c_hw;
+
+	count = (size + chunk_size - 1) / chunk_size;
+	job.size = size;
+	job.chunk_size = chunk_size;
+	job.algos = algos;
+	job.chunks = calloc(count, sizeof(*job.chunks));
+	if (!job.chunks)
+		return EXIT_FAILURE;
+
+	if (map_memory(memdev, size, PROT_READ, target, &mem)) {
+		free(job.chunks);
+		return EXIT_FAILURE;
+	}
+	job.data = (const uint8_t *)mem.v_ptr;
+
+	if (threads <= 0)
+		threads = auto_thread_count(size);
+	if (threads > count)
+		threads = count;
+
+	if (run_sharded(target, size, threads, false, hash_shard, &job)) {
+		fprintf(stderr, "Failed to start hashing threads\n");
+		unmap_memory(&mem);
+		free(job.chunks);
+		return EXIT_FAILURE;
+	}
+
+	if (manifest) {
+		for (off_t i = 0; i < count; i++) {
+			off_t len = size - i * chunk_size < chunk_size ? size - i * chunk_size : chunk_size;
+
+			printf("0x%08jx %jd", (intmax_t)(target + i * chunk_size), (intmax_t)len);
+			print_chunk(&job.chunks[i], algos, NULL);
+		}
+	}
+
+	if (combine_chunks(&job, count, &total)) {
+		fprintf(stderr, "Not enough memory to combine %jd chunk digests\n", (intmax_t)count);
+		unmap_memory(&mem);
+		free(job.chunks);
+		return EXIT_FAILURE;
+	}
+	if (algos & HASH_CRC32C)
+		printf("crc32c %08" PRIx32 "\n", total.crc32c);
+	if (algos & HASH_XXH64)
+		printf("xxh64  %016" PRIx64 "\n", total.xxh64);
+	if (algos & HASH_SHA256) {
+		printf("sha256 ");
+		print_hex(total.sha256, sizeof(total.sha256));
+		putchar('\n');
+	}
+
+	unmap_memory(&mem);
+	free(job.chunks);
+
+	return EXIT_SUCCESS;
+}
@@ -1,4 +1,6 @@
+#define _GNU_SOURCE
 #include <ctype.h>
+#include <errno.h>
 #include <fcntl.h>
 #include <getopt.h>
 #include <inttypes.h>
@@ -15,12 +17,117 @@
 
 #include "mem.h"
 
+/* Read the file into a bounce buffer and write the device with the requested access width */
+static int load_width(int in_fd, char *dst, off_t size, char width)
+{
+	char *bounce = malloc(BOUNCE_SIZE);
+	off_t done;
+
+	if (!bounce)
+		return -1;
+
+	for (done = 0; done < size; done += BOUNCE_SIZE) {
+		size_t chunk = size - done < BOUNCE_SIZE ? size - done : BOUNCE_SIZE;
+
+		if (read_full(in_fd, bounce, chunk) != chunk) {
+			free(bounce);
+			return -1;
+		}
+		copy_width(dst + done, bounce, chunk, width);
+	}
+	free(bounce);
+
+	return 0;
+}
+
+/* Read size bytes from the current file position, through the pipeline when there is one */
+static int load_extent(int in_fd, char *dst, off_t size, char width, struct io_pipeline *pipeline)
+{
+	off_t offset;
+
+	if (width)
+		return load_width(in_fd, dst, size, width);
+	if (!pipeline)
+		return read_full(in_fd, dst, size) == size ? 0 : -1;
+
+	offset = lseek(in_fd, 0, SEEK_CUR);
+	if (offset == -1 || io_pipeline_transfer(pipeline, in_fd, dst, size, offset, false))
+		return -1;
+
+	return lseek(in_fd, offset + size, SEEK_SET) == -1 ? -1 : 0;
+}
+
+static int zero_fill(char *dst, off_t size, char width)
+{
+	char *zero;
+
+	if (!width) {
+		memset(dst, 0, size);
+		return 0;
+	}
+
+	zero = calloc(1, BOUNCE_SIZE);
+	if (!zero)
+		return -1;
+	for (off_t done = 0; done < size; done += BOUNCE_SIZE)
+		copy_width(dst + done, zero, size - done < BOUNCE_SIZE ? size - done : BOUNCE_SIZE, width);
+	free(zero);
+
+	return 0;
+}
+
+/*
+ * Only read the data extents of a sparse file, found with SEEK_DATA and
+ * SEEK_HOLE, and either zero the memory under the holes or leave it alone.
+ */
+static int load_sparse(int in_fd, char *dst, off_t size, char width, bool skip_holes, struct io_pipeline *pipeline)
+{
+	off_t pos = 0;
+
+	while (pos < size) {
+		off_t data = lseek(in_fd, pos, SEEK_DATA);
+		off_t hole;
+
+		if (data == -1) {
+			/* No data past pos, the rest of the file is a hole */
+			if (errno != ENXIO)
+				return -1;
+			data = size;
+		}
+		if (data > size)
+			data = size;
+
+		if (data > pos && !skip_holes && zero_fill(dst + pos, data - pos, width))
+			return -1;
+		if (data == size)
+			break;
+
+		hole = lseek(in_fd, data, SEEK_HOLE);
+		if (hole == -1)
+			return -1;
+		if (hole > size)
+			hole = size;
+
+		if (lseek(in_fd, data, SEEK_SET) == -1 || load_extent(in_fd, dst + data, hole - data, width, pipeline))
+			return -1;
+		pos = hole;
+	}
+
+	return 0;
+}
+
 static void do_load_help(FILE *output)
 {
 	fprintf(output, "Usage:\nmem load [options] <address> <input_file>\n\n");
 	fprintf(output, "load memory content in output file.\n");
 	fprintf(output, "Options:\n");
 	fprintf(output, " -m, --mem-dev\t\t memory device to use (default is /dev/mem)\n");
+	fprintf(output, " -M, --method\t\t input method: auto, read or uring (default is auto)\n");
+	fprintf(output, " -q, --queue-depth\t requests kept in flight by the uring method (default is 32)\n");
+	fprintf(output, " -W, --width\t\t write the memory only with [b]yte, [h]alfword, [w]ord or [l]ong accesses\n");
+	fprintf(output, " -z, --sparse\t\t only read the data extents of a sparse file and zero the holes\n");
+	fprintf(output, " -k, --skip-holes\t like --sparse, but leave the memory under holes untouched\n");
+	fprintf(output, " -v, --verbose\t\t Report the achieved throughput\n");
 	fprintf(output, " -h, --help\t\t Display this help screen\n");
 	fprintf(output, "Arguments:\n");
 	fprintf(output, " <address> can be given in decimal, hexedecimal or octal format\n");
@@ -33,6 +140,15 @@ int do_load(int argc, char **argv)
 	off_t target;
 	off_t size;
 	int in_fd;
+	char width = 0;
+	bool sparse = false;
+	bool skip_holes = false;
+	int rc;
+	off_t queue_depth = DEFAULT_QUEUE_DEPTH;
+	const char *method = "auto";
+	struct io_pipeline *pipeline = NULL;
+	bool verbose = false;
+	uint64_t start, elapsed;
 	char *memdev = "/dev/mem";
 	struct mapped_mem mem;
 
@@ -40,13 +156,19 @@ int do_load(int argc, char **argv)
 		// clang-format off
 		static struct option long_options[] = {
 			{"mem-dev", required_argument, 0, 'm'},
+			{"method", required_argument, 0, 'M'},
+			{"queue-depth", required_argument, 0, 'q'},
+			{"width", required_argument, 0, 'W'},
+			{"sparse", no_argument, 0, 'z'},
+			{"skip-holes", no_argument, 0, 'k'},
+			{"verbose", no_argument, 0, 'v'},
 			{"help", no_argument, 0, 'h'},
 			{0, 0, 0, 0}
 		};
 		// clang-format on
 		int option_index = 0;
 
-		c = getopt_long(argc, argv, "m:h", long_options, &option_index);
+		c = getopt_long(argc, argv, "m:M:q:W:zkvh", long_options, &option_index);
 
 		/* Detect the end of the options. */
 		if (c == -1)
@@ -56,6 +178,35 @@ int do_load(int argc, char **argv)
 		case 'm':
 			memdev = optarg;
 			break;
+		case 'M':
+			method = optarg;
+			if (strcmp(method, "auto") && strcmp(method, "read") && strcmp(method, "uring")) {
+				fprintf(stderr, "Unknown input method %s\n", optarg);
+				return EXIT_FAILURE;
+			}
+			break;
+		case 'q':
+			if (parse_input(optarg, &queue_depth) || queue_depth < 1) {
+				do_load_help(stderr);
+				return EXIT_FAILURE;
+			}
+			break;
+		case 'W':
+			width = tolower(*optarg);
+			if (!access_size(width)) {
+				fprintf(stderr, "Unsupported access width %s\n", optarg);
+				return EXIT_FAILURE;
+			}
+			break;
+		case 'k':
+			skip_holes = true;
+			/* fall through */
+		case 'z':
+			sparse = true;
+			break;
+		case 'v':
+			verbose = true;
+			break;
 		case 'h':
 			do_load_help(stdout);
 			return EXIT_SUCCESS;
@@ -78,27 +229,66 @@ int do_load(int argc, char **argv)
 
 	if (parse_input(argv[optind], &target)) {
 		do_load_help(stderr);
-		exit(EXIT_FAILURE);
+		return EXIT_FAILURE;
 	}
 
 	in_fd = open(argv[optind + 1], O_RDONLY);
 	if (in_fd == -1) {
 		perror("Can't open file for output");
-		exit(EXIT_FAILURE);
+		return EXIT_FAILURE;
 	}
 
 	struct stat buf;
 	fstat(in_fd, &buf);
 	size = buf.st_size;
 
-	if (map_memory(memdev, size, PROT_WRITE, target, &mem))
-		exit(EXIT_FAILURE);
+	if (width && !width_aligned(target, size, width)) {
+		fprintf(stderr, "Address and file size must be aligned to the access width\n");
+		close(in_fd);
+		return EXIT_FAILURE;
+	}
 
-	if (read(in_fd, mem.v_ptr, size) != size) {
+	if (map_memory(memdev, size, PROT_WRITE, target, &mem)) {
+		close(in_fd);
+		return EXIT_FAILURE;
+	}
+
+	/* Only the read path controls the access width, positioned reads need a regular file */
+	if (!width && strcmp(method, "read") && S_ISREG(buf.st_mode)) {
+		pipeline = io_pipeline_open(queue_depth, IO_REQUEST_SIZE);
+		if (!pipeline) {
+			unmap_memory(&mem);
+			close(in_fd);
+			return EXIT_FAILURE;
+		}
+	}
+
+	start = get_time_ns();
+	if (sparse)
+		rc = load_sparse(in_fd, mem.v_ptr, size, width, skip_holes, pipeline);
+	else
+		rc = load_extent(in_fd, mem.v_ptr, size, width, pipeline);
+	elapsed = get_time_ns() - start;
+
+	if (pipeline) {
+		/* Without io_uring the pipeline quietly runs on a thread pool */
+		method = io_pipeline_engine(pipeline);
+		io_pipeline_close(pipeline, verbose && !rc);
+	} else {
+		method = "read";
+	}
+
+	if (rc) {
 		perror("Failed reading file content to memory");
+		unmap_memory(&mem);
+		close(in_fd);
 		return EXIT_FAILURE;
 	}
 
+	if (verbose)
+		fprintf(stderr, "Loaded %jd bytes in %.3f s (%.1f MB/s) using %s\n", (intmax_t)size, elapsed / 1e9,
+		        elapsed ? size * 1e3 / elapsed : 0.0, method);
+
 	unmap_memory(&mem);
 	close(in_fd);
 
@@ -4,6 +4,7 @@
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <sys/resource.h>
 #include <sys/types.h>
 #include <unistd.h>
 
@@ -56,7 +57,7 @@ static int do_help(int argc, char **argv);
 // clang-format off
 static const struct cmd {
 	const char *cmd;
-	int (*func)(int argc, char **argv);
+	cmd_func func;
 	} cmds[] = {
 		{"devmem", do_devmem},
 		{"dump", do_dump},
@@ -64,6 +65,13 @@ static const struct cmd {
 		{"store", do_store},
 		{"compare", do_compare},
 		{"copy", do_copy},
+		{"poll", do_poll},
+		{"bench", do_bench},
+		{"hash", do_hash},
+		{"fill", do_fill},
+		{"find", do_find},
+		{"test", do_test},
+		{"shell", do_shell},
 		{"help", do_help},
 		{0}
 	};
@@ -71,7 +79,19 @@ static const struct cmd {
 
 static int do_help(int argc, char **argv)
 {
-	printf("Usage:\nmem [cmd] ...\n\n");
+	printf("Usage:\nmem [global options] [cmd] ...\n\n");
+	printf("Global options:\n");
+	printf("\t--map-budget <size>\tbytes of mappings kept cached between accesses\n");
+	printf("\t--cache <policy>\tauto, uc, wc or wb mapping of the memory (default is auto,\n");
+	printf("\t\t\t\twrite-back for System RAM and uncached for anything else)\n");
+	printf("\t\t\t\twc needs a PCI BAR resourceN that has a resourceN_wc file\n");
+	printf("\t--prefault\t\tpopulate mappings when they are created\n");
+	printf("\t--huge-pages\t\talign mappings for huge pages where the backing supports them\n");
+	printf("\t--mlock\t\t\tlock mappings in memory\n");
+	printf("\t--faults\t\treport the page faults taken by the command\n");
+	printf("\t--stats[=json]\t\ton exit, print the time spent parsing, mapping, in the command\n");
+	printf("\t\t\t\titself, on file I/O and unmapping, the bytes moved, page faults and\n");
+	printf("\t\t\t\tcycle, LLC and dTLB miss counters when perf events are available\n\n");
 	printf("Available commands:\n");
 	for (int i = 0; i < (ARRAY_LENGTH(cmds)) - 1; i++)
 		printf("\t%s\n", cmds[i].cmd);
@@ -80,25 +100,124 @@ static int do_help(int argc, char **argv)
 	return 0;
 }
 
-static int do_cmd(int argc, char **argv)
+/* The handler of the subcommand name, which may carry trailing characters */
+cmd_func find_cmd(const char *name)
 {
 	const struct cmd *c;
 
 	for (c = cmds; c->cmd; ++c) {
-		if (strncmp(argv[0], c->cmd, strlen(c->cmd)) == 0)
-			return (c->func(argc, argv));
+		if (strncmp(name, c->cmd, strlen(c->cmd)) == 0)
+			return c->func;
 	}
 
+	return NULL;
+}
+
+int do_cmd(int argc, char **argv)
+{
+	cmd_func func = find_cmd(argv[0]);
+
+	if (func)
+		return func(argc, argv);
+
 	fprintf(stderr, "Subcommand \"%s\" is unknown, try \"mem help\".\n", argv[0]);
 	return EXIT_FAILURE;
 }
 
+// clang-format off
+static const struct map_option {
+	const char *name;
+	int flag;
+	} map_options[] = {
+		{"prefault", MAP_OPT_PREFAULT},
+		{"huge-pages", MAP_OPT_HUGE},
+		{"mlock", MAP_OPT_LOCK},
+		{0}
+	};
+// clang-format on
+
+static bool report_faults;
+
+/* Global options come before the subcommand and accept "--opt value" and "--opt=value" */
+static int parse_global_options(int argc, char **argv)
+{
+	const struct map_option *opt;
+	int options = 0;
+	int i;
+
+	for (i = 1; i < argc && !strncmp(argv[i], "--", 2); i++) {
+		const char *name = argv[i] + 2;
+		const char *value = strchr(name, '=');
+		size_t len = value ? (size_t)(value - name) : strlen(name);
+		off_t val;
+
+		if (len == strlen("map-budget") && !strncmp(name, "map-budget", len)) {
+			if (value)
+				value++;
+			else if (i + 1 < argc)
+				value = argv[++i];
+			if (!value || parse_input(value, &val))
+				return -1;
+			map_cache_set_budget(val);
+		} else if (len == strlen("cache") && !strncmp(name, "cache", len)) {
+			if (value)
+				value++;
+			else if (i + 1 < argc)
+				value = argv[++i];
+			if (!value || set_cache_policy(value))
+				return -1;
+		} else if (!value && !strcmp(name, "faults")) {
+			report_faults = true;
+		} else if (len == strlen("stats") && !strncmp(name, "stats", len)) {
+			/* The format is optional, so it can only be given as --stats=format */
+			if (stats_enable(value ? value + 1 : NULL))
+				return -1;
+		} else {
+			for (opt = map_options; opt->name; opt++)
+				if (!value && !strcmp(name, opt->name))
+					break;
+			if (!opt->name) {
+				fprintf(stderr, "Unknown global option %s, try \"mem help\".\n", argv[i]);
+				return -1;
+			}
+			options |= opt->flag;
+		}
+	}
+
+	set_map_options(options);
+
+	return i;
+}
+
 int main(int argc, char **argv)
 {
-	if (argc < 2) {
+	uint64_t start = get_time_ns();
+	int first = parse_global_options(argc, argv);
+	int rc;
+
+	if (first < 0)
+		return EXIT_FAILURE;
+
+	if (argc - first < 1) {
 		do_help(argc, argv);
 		return EXIT_FAILURE;
 	}
 
-	return do_cmd(argc - 1, argv + 1);
+	stats_begin(argv[first], start);
+
+	if (report_faults) {
+		struct rusage before, after;
+
+		getrusage(RUSAGE_SELF, &before);
+		rc = do_cmd(argc - first, argv + first);
+		getrusage(RUSAGE_SELF, &after);
+		fprintf(stderr, "Page faults: %ld minor, %ld major\n", after.ru_minflt - before.ru_minflt,
+		        after.ru_majflt - before.ru_majflt);
+	} else {
+		rc = do_cmd(argc - first, argv + first);
+	}
+
+	stats_end(rc);
+
+	return rc;
 }
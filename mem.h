@@ -1,24 +1,143 @@
 #ifndef MEMTOOL_H
 #define MEMTOOL_H
 
+#include <stdbool.h>
+#include <stdint.h>
 #include <sys/types.h>
 
+/* Don't bother spawning a worker for less than this */
+#define MIN_SHARD_SIZE (16 * 1024 * 1024)
+/* Address space kept mapped by the mapping cache once mappings are released */
+#define DEFAULT_MAP_BUDGET (256 * 1024 * 1024)
+/* Bounce buffer used when data has to go through a width controlled copy */
+#define BOUNCE_SIZE (1024 * 1024)
+/* Requests kept in flight and their size for pipelined file I/O */
+#define DEFAULT_QUEUE_DEPTH 32
+#define IO_REQUEST_SIZE (1024 * 1024)
+
+/* Options applied to every new mapping, see set_map_options() */
+#define MAP_OPT_PREFAULT (1 << 0)
+#define MAP_OPT_HUGE     (1 << 1)
+#define MAP_OPT_LOCK     (1 << 2)
+
+struct map_window;
+
 struct mapped_mem {
 	char *v_ptr;
 	void *base;
 	off_t mapped_size;
+	struct map_window *window;
+};
+
+struct shard {
+	off_t offset;
+	off_t len;
+	int index;
+};
+
+typedef int (*shard_func)(const struct shard *shard, void *arg);
+typedef int (*cmd_func)(int argc, char **argv);
+
+struct mem_range {
+	off_t address;
+	off_t length;
+	char *name;
+	/* Set by range_list_map() */
+	const char *data;
+};
+
+struct range_list {
+	struct mem_range *ranges;
+	int count;
+	struct mapped_mem *spans;
+	int span_count;
+};
+
+/* Phases accounted by --stats, see stats_account() */
+enum stats_phase {
+	STATS_MAP,
+	STATS_UNMAP,
+	STATS_READ,
+	STATS_WRITE,
+	/* Bytes only: register accesses are too fine grained to time */
+	STATS_ACCESS,
+	STATS_PHASES,
 };
 
+struct snapshot;
+struct io_pipeline;
+struct range_container;
+
 int do_dump(int argc, char **argv);
 int do_copy(int argc, char **argv);
 int do_compare(int argc, char **argv);
 int do_load(int argc, char **argv);
 int do_store(int argc, char **argv);
 int do_devmem(int argc, char **argv);
+int do_shell(int argc, char **argv);
+int do_poll(int argc, char **argv);
+int do_bench(int argc, char **argv);
+int do_hash(int argc, char **argv);
+int do_fill(int argc, char **argv);
+int do_find(int argc, char **argv);
+int do_test(int argc, char **argv);
+int do_cmd(int argc, char **argv);
+cmd_func find_cmd(const char *name);
 int parse_input(const char *input, off_t *val);
 
+int set_cache_policy(const char *name);
+void set_map_options(int options);
+bool memory_uncached(const char *memdev, off_t start, off_t end);
+const char *memory_cache_mode(const char *memdev, off_t start, off_t end);
+int open_memory(const char *memdev, int props, bool uncached);
+int map_memory_fd(int fd, off_t size, int props, off_t target, struct mapped_mem *mem);
 int map_memory(char *memdev, off_t size, int props, off_t target, struct mapped_mem *mem);
 void unmap_memory(struct mapped_mem *mem);
+void map_cache_set_budget(off_t budget);
+void map_cache_flush(void);
+int access_size(char access_type);
+uint64_t read_value(const char *ptr, char access_type);
+uint64_t write_value(char *ptr, char access_type, uint64_t val);
+void copy_width(char *dst, const char *src, size_t len, char access_type);
+void store_element(char *p, int element, uint64_t val);
+bool width_aligned(off_t addr, off_t len, char access_type);
+ssize_t read_full(int fd, void *buf, size_t count);
+ssize_t write_full(int fd, const void *buf, size_t count);
+uint64_t get_time_ns(void);
+int auto_thread_count(off_t size);
+int run_sharded(off_t base, off_t size, int threads, bool numa, shard_func func, void *arg);
+int run_parallel(int count, int threads, int (*func)(int index, void *arg), void *arg);
+
+size_t mem_scan(const char *a, const char *b, size_t len, bool want_equal);
+bool mem_is_zero(const char *p, size_t len);
+void sha256(const uint8_t *p, size_t len, uint8_t *digest);
+
+struct snapshot *snapshot_open(const char *dir, off_t address, off_t length, off_t chunk_size);
+int snapshot_add(struct snapshot *snap, const char *data, size_t len);
+int snapshot_finish(struct snapshot *snap, const char *index_path, bool verbose);
+void snapshot_free(struct snapshot *snap);
+int snapshot_rebuild(const char *dir, const char *index_path, int out_fd);
+
+struct io_pipeline *io_pipeline_open(unsigned int depth, size_t request_size);
+int io_pipeline_transfer(struct io_pipeline *p, int fd, char *buf, size_t len, off_t offset, bool write);
+const char *io_pipeline_engine(const struct io_pipeline *p);
+void io_pipeline_close(struct io_pipeline *p, bool verbose);
+
+int range_list_load(const char *path, struct range_list *list);
+int range_list_map(struct range_list *list, char *memdev, int props);
+void range_list_free(struct range_list *list);
+const char *range_label(const struct mem_range *r, char *buf, size_t len);
+int range_container_store(int fd, const struct range_list *list, int threads);
+struct range_container *range_container_open(const char *path);
+int range_container_map(const struct range_container *c, const struct mem_range *r, struct mapped_mem *mem);
+void range_container_close(struct range_container *c);
+
+int stats_enable(const char *format);
+void stats_begin(const char *cmd, uint64_t start);
+uint64_t stats_start(void);
+void stats_account(enum stats_phase phase, uint64_t start, off_t bytes);
+void stats_count(enum stats_phase phase, off_t bytes);
+void stats_end(int rc);
 
 #define TRACE() fprintf(stderr, "%s:%u\n", __FILE__, __LINE__)
 #endif
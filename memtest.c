@@ -0,0 +1,396 @@
+#include <getopt.h>
+#include <inttypes.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/types.h>
+#include <unistd.h>
+
+#include "mem.h"
+
+#define ARRAY_LENGTH(x) (sizeof(x) / sizeof((x)[0]))
+
+struct test_job;
+
+/* Value word <index> of the range must hold during the current pass */
+typedef uint64_t (*pattern_func)(const struct test_job *job, off_t index);
+
+struct memtest {
+	const char *name;
+	int passes;
+	pattern_func pattern;
+	/* Moving inversions walk the range up and down complementing the pattern */
+	bool moving;
+};
+
+struct test_job {
+	volatile uint64_t *words;
+	off_t address;
+	const struct memtest *test;
+	int pass;
+	uint64_t seed;
+	off_t errors;
+	off_t max_errors;
+};
+
+static uint64_t splitmix64(uint64_t x)
+{
+	x += 0x9e3779b97f4a7c15ULL;
+	x = (x ^ (x >> 30)) * 0xbf58476d1ce4e5b9ULL;
+	x = (x ^ (x >> 27)) * 0x94d049bb133111ebULL;
+
+	return x ^ (x >> 31);
+}
+
+static uint64_t walking_ones(const struct test_job *job, off_t index)
+{
+	return 1ULL << ((index + job->pass) & 63);
+}
+
+static uint64_t walking_zeros(const struct test_job *job, off_t index)
+{
+	return ~walking_ones(job, index);
+}
+
+static uint64_t own_address(const struct test_job *job, off_t index)
+{
+	uint64_t address = job->address + index * sizeof(uint64_t);
+
+	return job->pass ? ~address : address;
+}
+
+static uint64_t checkerboard(const struct test_job *job, off_t index)
+{
+	return (index + job->pass) & 1 ? 0xaaaaaaaaaaaaaaaaULL : 0x5555555555555555ULL;
+}
+
+static uint64_t random_data(const struct test_job *job, off_t index)
+{
+	uint64_t val = splitmix64(job->seed + index);
+
+	return job->pass ? ~val : val;
+}
+
+static uint64_t solid(const struct test_job *job, off_t index)
+{
+	return job->pass ? 0x5555555555555555ULL : 0;
+}
+
+// clang-format off
+static const struct memtest tests[] = {
+	{"walking-ones", 64, walking_ones, false},
+	{"walking-zeros", 64, walking_zeros, false},
+	{"address", 2, own_address, false},
+	{"checkerboard", 2, checkerboard, false},
+	{"random", 2, random_data, false},
+	{"moving-inversions", 2, solid, true},
+	{0}
+};
+// clang-format on
+
+static void report(struct test_job *job, off_t index, uint64_t expected, uint64_t actual)
+{
+	off_t errors = __atomic_add_fetch(&job->errors, 1, __ATOMIC_RELAXED);
+
+	if (errors > job->max_errors)
+		return;
+
+	printf("%s: 0x%jx expected 0x%016" PRIx64 " read 0x%016" PRIx64 " (bits 0x%016" PRIx64 ")\n",
+	       job->test->name, (uintmax_t)(job->address + index * sizeof(uint64_t)), expected, actual,
+	       expected ^ actual);
+}
+
+static int write_shard(const struct shard *shard, void *arg)
+{
+	struct test_job *job = arg;
+	off_t first = shard->offset / sizeof(uint64_t);
+	off_t last = first + shard->len / sizeof(uint64_t);
+
+	for (off_t i = first; i < last; i++)
+		job->words[i] = job->test->pattern(job, i);
+
+	return 0;
+}
+
+static int verify_shard(const struct shard *shard, void *arg)
+{
+	struct test_job *job = arg;
+	off_t first = shard->offset / sizeof(uint64_t);
+	off_t last = first + shard->len / sizeof(uint64_t);
+
+	for (off_t i = first; i < last; i++) {
+		uint64_t expected = job->test->pattern(job, i);
+		uint64_t actual = job->words[i];
+
+		if (actual != expected)
+			report(job, i, expected, actual);
+	}
+
+	return 0;
+}
+
+/* Check every word for the pattern and replace it with its complement, bottom up */
+static int invert_up_shard(const struct shard *shard, void *arg)
+{
+	struct test_job *job = arg;
+	off_t first = shard->offset / sizeof(uint64_t);
+	off_t last = first + shard->len / sizeof(uint64_t);
+
+	for (off_t i = first; i < last; i++) {
+		uint64_t expected = job->test->pattern(job, i);
+		uint64_t actual = job->words[i];
+
+		if (actual != expected)
+			report(job, i, expected, actual);
+		job->words[i] = ~expected;
+	}
+
+	return 0;
+}
+
+/* Check every word for the complement and restore the pattern, top down */
+static int invert_down_shard(const struct shard *shard, void *arg)
+{
+	struct test_job *job = arg;
+	off_t first = shard->offset / sizeof(uint64_t);
+	off_t last = first + shard->len / sizeof(uint64_t);
+
+	for (off_t i = last - 1; i >= first; i--) {
+		uint64_t expected = ~job->test->pattern(job, i);
+		uint64_t actual = job->words[i];
+
+		if (actual != expected)
+			report(job, i, expected, actual);
+		job->words[i] = ~expected;
+	}
+
+	return 0;
+}
+
+/* Run one pass of the test and return the number of bytes moved, or -1 */
+static off_t run_pass(struct test_job *job, off_t size, int threads, bool numa)
+{
+	static const shard_func plain[] = {write_shard, verify_shard, NULL};
+	static const shard_func moving[] = {write_shard, invert_up_shard, invert_down_shard, verify_shard, NULL};
+	const shard_func *step = job->test->moving ? moving : plain;
+	off_t moved = 0;
+
+	/* Every step covers the whole range before the next one starts */
+	for (; *step; step++) {
+		if (run_sharded(job->address, size, threads, numa, *step, job))
+			return -1;
+		moved += (*step == invert_up_shard || *step == invert_down_shard) ? 2 * size : size;
+	}
+
+	return moved;
+}
+
+static const struct memtest *find_test(const char *name, size_t len)
+{
+	for (const struct memtest *test = tests; test->name; test++)
+		if (strlen(test->name) == len && !strncmp(test->name, name, len))
+			return test;
+
+	return NULL;
+}
+
+static void do_test_help(FILE *output)
+{
+	fprintf(output, "Usage:\nmem test [options] <address> <size>\n\n");
+	fprintf(output, "Destructively test <size> bytes of memory at <address>.\n");
+	fprintf(output, "Options:\n");
+	fprintf(output, " -m, --mem-dev\t\t memory device to use (default is /dev/mem)\n");
+	fprintf(output, " -T, --tests\t\t comma separated list of tests to run (default is all)\n");
+	fprintf(output, " -s, --seed\t\t seed of the random test (default is 0)\n");
+	fprintf(output, " -l, --loops\t\t number of times to run the tests (default is 1)\n");
+	fprintf(output, " -e, --max-errors\t number of failing words printed per test (default is 32)\n");
+	fprintf(output, " -t, --threads\t\t number of test threads (default is 0, automatic)\n");
+	fprintf(output, " -n, --numa\t\t pin each thread to the NUMA node owning its range\n");
+	fprintf(output, " -v, --verbose\t\t Report the throughput of every pass\n");
+	fprintf(output, " -h, --help\t\t Display this help screen\n");
+	fprintf(output, "Arguments:\n");
+	fprintf(output, " <address> can be given in decimal, hexedecimal or octal format\n");
+	fprintf(output, " <size> can be given in decimal, hexedecimal or octal format\n");
+	fprintf(output, "Note: base is detect according to the prefix (no-prefix, 0x, and 0).\n");
+	fprintf(output, "Tests:");
+	for (const struct memtest *test = tests; test->name; test++)
+		fprintf(output, " %s", test->name);
+	fprintf(output, "\n");
+}
+
+int do_test(int argc, char **argv)
+{
+	int c;
+	off_t target;
+	off_t size;
+	off_t seed = 0;
+	off_t loops = 1;
+	off_t max_errors = 32;
+	off_t threads = 0;
+	off_t failed = 0;
+	bool numa = false;
+	bool verbose = false;
+	bool selected[ARRAY_LENGTH(tests)] = {false};
+	char *memdev = "/dev/mem";
+	struct mapped_mem mem;
+
+	while (1) {
+		// clang-format off
+		static struct option long_options[] = {
+			{"mem-dev", required_argument, 0, 'm'},
+			{"tests", required_argument, 0, 'T'},
+			{"seed", required_argument, 0, 's'},
+			{"loops", required_argument, 0, 'l'},
+			{"max-errors", required_argument, 0, 'e'},
+			{"threads", required_argument, 0, 't'},
+			{"numa", no_argument, 0, 'n'},
+			{"verbose", no_argument, 0, 'v'},
+			{"help", no_argument, 0, 'h'},
+			{0, 0, 0, 0}
+		};
+		// clang-format on
+		int option_index = 0;
+		const char *name;
+
+		c = getopt_long(argc, argv, "m:T:s:l:e:t:nvh", long_options, &option_index);
+
+		/* Detect the end of the options. */
+		if (c == -1)
+			break;
+
+		switch (c) {
+		case 'm':
+			memdev = optarg;
+			break;
+		case 'T':
+			for (name = optarg; *name;) {
+				size_t len = strcspn(name, ",");
+				const struct memtest *test = find_test(name, len);
+
+				if (!test) {
+					fprintf(stderr, "Unknown test %.*s\n", (int)len, name);
+					do_test_help(stderr);
+					return EXIT_FAILURE;
+				}
+				selected[test - tests] = true;
+				name += len + (name[len] == ',');
+			}
+			break;
+		case 's':
+			if (parse_input(optarg, &seed)) {
+				do_test_help(stderr);
+				return EXIT_FAILURE;
+			}
+			break;
+		case 'l':
+			if (parse_input(optarg, &loops)) {
+				do_test_help(stderr);
+				return EXIT_FAILURE;
+			}
+			break;
+		case 'e':
+			if (parse_input(optarg, &max_errors)) {
+				do_test_help(stderr);
+				return EXIT_FAILURE;
+			}
+			break;
+		case 't':
+			if (parse_input(optarg, &threads)) {
+				do_test_help(stderr);
+				return EXIT_FAILURE;
+			}
+			break;
+		case 'n':
+			numa = true;
+			break;
+		case 'v':
+			verbose = true;
+			break;
+		case 'h':
+			do_test_help(stdout);
+			return EXIT_SUCCESS;
+		case '?':
+			/* getopt_long already printed an error message. */
+			return EXIT_FAILURE;
+		default:
+			fprintf(stderr, "Unsupported option\n");
+			do_test_help(stderr);
+			return EXIT_FAILURE;
+			break;
+		}
+	};
+
+	if (argc - optind != 2) {
+		fprintf(stderr, "Missing address or size\n");
+		do_test_help(stderr);
+		return EXIT_FAILURE;
+	}
+
+	if (parse_input(argv[optind], &target)) {
+		do_test_help(stderr);
+		return EXIT_FAILURE;
+	}
+
+	if (parse_input(argv[optind + 1], &size)) {
+		do_test_help(stderr);
+		return EXIT_FAILURE;
+	}
+
+	if (!width_aligned(target, size, 'l')) {
+		fprintf(stderr, "Address and size must be aligned to 8 bytes\n");
+		return EXIT_FAILURE;
+	}
+
+	if (map_memory(memdev, size, PROT_READ | PROT_WRITE, target, &mem))
+		return EXIT_FAILURE;
+
+	for (off_t loop = 0; loop < loops; loop++) {
+		for (const struct memtest *test = tests; test->name; test++) {
+			struct test_job job = {
+				.words = (volatile uint64_t *)mem.v_ptr,
+				.address = target,
+				.test = test,
+				.seed = seed,
+				.max_errors = max_errors,
+			};
+			uint64_t start = get_time_ns();
+			uint64_t elapsed;
+			off_t moved = 0;
+
+			if (memchr(selected, true, sizeof(selected)) && !selected[test - tests])
+				continue;
+
+			for (job.pass = 0; job.pass < test->passes; job.pass++) {
+				uint64_t pass_start = get_time_ns();
+				off_t pass_moved = run_pass(&job, size, threads, numa);
+
+				if (pass_moved < 0) {
+					fprintf(stderr, "Failed to start test threads\n");
+					unmap_memory(&mem);
+					return EXIT_FAILURE;
+				}
+				moved += pass_moved;
+
+				elapsed = get_time_ns() - pass_start;
+				if (verbose)
+					printf("%s: pass %d/%d %.2f GB/s\n", test->name, job.pass + 1, test->passes,
+					       elapsed ? (double)pass_moved / elapsed : 0.0);
+			}
+
+			elapsed = get_time_ns() - start;
+			if (job.errors)
+				printf("%-18s FAILED, %jd errors, %.2f GB/s\n", test->name, (intmax_t)job.errors,
+				       elapsed ? (double)moved / elapsed : 0.0);
+			else
+				printf("%-18s ok, %.2f GB/s\n", test->name, elapsed ? (double)moved / elapsed : 0.0);
+			failed += job.errors;
+		}
+	}
+
+	unmap_memory(&mem);
+
+	return failed ? EXIT_FAILURE : EXIT_SUCCESS;
+}
@@ -0,0 +1,379 @@
+#define _GNU_SOURCE
+#include <errno.h>
+#include <inttypes.h>
+#include <linux/io_uring.h>
+#include <pthread.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include <sys/types.h>
+#include <unistd.h>
+
+#include "mem.h"
+
+/* The thread pool fallback doesn't get more workers than this */
+#define MAX_POOL_THREADS 64
+
+struct uring {
+	int fd;
+	unsigned int entries;
+	unsigned int *sq_head;
+	unsigned int *sq_tail;
+	unsigned int *sq_mask;
+	unsigned int *sq_array;
+	unsigned int *cq_head;
+	unsigned int *cq_tail;
+	unsigned int *cq_mask;
+	struct io_uring_sqe *sqes;
+	struct io_uring_cqe *cqes;
+	void *sq_ring;
+	void *cq_ring;
+	size_t sq_ring_size;
+	size_t cq_ring_size;
+	size_t sqes_size;
+};
+
+struct io_pipeline {
+	unsigned int depth;
+	size_t request_size;
+	bool has_uring;
+	struct uring ring;
+	/* Requests in flight, sampled every time one is issued */
+	uint64_t depth_sum;
+	uint64_t depth_samples;
+	unsigned int max_depth;
+	off_t bytes;
+	uint64_t elapsed;
+};
+
+/* Move len bytes between buf and the file at offset with plain pread/pwrite */
+static int transfer_full(int fd, char *buf, size_t len, off_t offset, bool write)
+{
+	while (len) {
+		ssize_t ret = write ? pwrite(fd, buf, len, offset) : pread(fd, buf, len, offset);
+
+		if (ret == -1 && errno == EINTR)
+			continue;
+		if (ret <= 0) {
+			if (!ret)
+				errno = EIO;
+			return -1;
+		}
+		buf += ret;
+		len -= ret;
+		offset += ret;
+	}
+
+	return 0;
+}
+
+static void record_depth(struct io_pipeline *p, unsigned int inflight)
+{
+	unsigned int max = __atomic_load_n(&p->max_depth, __ATOMIC_RELAXED);
+
+	__atomic_add_fetch(&p->depth_sum, inflight, __ATOMIC_RELAXED);
+	__atomic_add_fetch(&p->depth_samples, 1, __ATOMIC_RELAXED);
+	while (inflight > max &&
+	       !__atomic_compare_exchange_n(&p->max_depth, &max, inflight, true, __ATOMIC_RELAXED, __ATOMIC_RELAXED))
+		;
+}
+
+static void uring_unmap(struct uring *ring)
+{
+	if (ring->sqes)
+		munmap(ring->sqes, ring->sqes_size);
+	if (ring->cq_ring && ring->cq_ring != ring->sq_ring)
+		munmap(ring->cq_ring, ring->cq_ring_size);
+	if (ring->sq_ring)
+		munmap(ring->sq_ring, ring->sq_ring_size);
+	close(ring->fd);
+}
+
+/*
+ * Set up an io_uring without liburing. Kernels that can't do plain
+ * IORING_OP_READ/WRITE (before 5.6, which also added IORING_FEAT_RW_CUR_POS)
+ * or forbid io_uring altogether get the thread pool instead.
+ */
+static int uring_setup(struct uring *ring, unsigned int entries)
+{
+	struct io_uring_params params;
+	char *sq, *cq;
+
+	memset(&params, 0, sizeof(params));
+	memset(ring, 0, sizeof(*ring));
+
+	ring->fd = syscall(__NR_io_uring_setup, entries, &params);
+	if (ring->fd == -1)
+		return -1;
+
+	if (!(params.features & IORING_FEAT_RW_CUR_POS)) {
+		close(ring->fd);
+		return -1;
+	}
+
+	ring->entries = params.sq_entries;
+	ring->sq_ring_size = params.sq_off.array + params.sq_entries * sizeof(unsigned int);
+	ring->cq_ring_size = params.cq_off.cqes + params.cq_entries * sizeof(struct io_uring_cqe);
+	if (params.features & IORING_FEAT_SINGLE_MMAP) {
+		if (ring->cq_ring_size > ring->sq_ring_size)
+			ring->sq_ring_size = ring->cq_ring_size;
+		ring->cq_ring_size = ring->sq_ring_size;
+	}
+
+	ring->sq_ring = mmap(NULL, ring->sq_ring_size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, ring->fd,
+	                     IORING_OFF_SQ_RING);
+	if (ring->sq_ring == MAP_FAILED) {
+		ring->sq_ring = NULL;
+		uring_unmap(ring);
+		return -1;
+	}
+
+	if (params.features & IORING_FEAT_SINGLE_MMAP) {
+		ring->cq_ring = ring->sq_ring;
+	} else {
+		ring->cq_ring = mmap(NULL, ring->cq_ring_size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE,
+		                     ring->fd, IORING_OFF_CQ_RING);
+		if (ring->cq_ring == MAP_FAILED) {
+			ring->cq_ring = NULL;
+			uring_unmap(ring);
+			return -1;
+		}
+	}
+
+	ring->sqes_size = params.sq_entries * sizeof(struct io_uring_sqe);
+	ring->sqes = mmap(NULL, ring->sqes_size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, ring->fd,
+	                  IORING_OFF_SQES);
+	if (ring->sqes == MAP_FAILED) {
+		ring->sqes = NULL;
+		uring_unmap(ring);
+		return -1;
+	}
+
+	sq = ring->sq_ring;
+	cq = ring->cq_ring;
+	ring->sq_head = (unsigned int *)(sq + params.sq_off.head);
+	ring->sq_tail = (unsigned int *)(sq + params.sq_off.tail);
+	ring->sq_mask = (unsigned int *)(sq + params.sq_off.ring_mask);
+	ring->sq_array = (unsigned int *)(sq + params.sq_off.array);
+	ring->cq_head = (unsigned int *)(cq + params.cq_off.head);
+	ring->cq_tail = (unsigned int *)(cq + params.cq_off.tail);
+	ring->cq_mask = (unsigned int *)(cq + params.cq_off.ring_mask);
+	ring->cqes = (struct io_uring_cqe *)(cq + params.cq_off.cqes);
+
+	return 0;
+}
+
+static void uring_queue(struct uring *ring, int fd, char *buf, size_t len, off_t offset, bool write)
+{
+	unsigned int tail = *ring->sq_tail;
+	unsigned int index = tail & *ring->sq_mask;
+	struct io_uring_sqe *sqe = &ring->sqes[index];
+
+	memset(sqe, 0, sizeof(*sqe));
+	sqe->opcode = write ? IORING_OP_WRITE : IORING_OP_READ;
+	sqe->fd = fd;
+	sqe->addr = (uintptr_t)buf;
+	sqe->len = len;
+	sqe->off = offset;
+	sqe->user_data = (uintptr_t)buf;
+	ring->sq_array[index] = index;
+
+	__atomic_store_n(ring->sq_tail, tail + 1, __ATOMIC_RELEASE);
+}
+
+/*
+ * Keep up to depth requests of request_size bytes in flight until the whole
+ * buffer went through. A completion's user_data is the start of its request,
+ * which is enough to finish a short transfer synchronously.
+ */
+static int uring_transfer(struct io_pipeline *p, int fd, char *buf, size_t len, off_t offset, bool write)
+{
+	struct uring *ring = &p->ring;
+	unsigned int depth = p->depth < ring->entries ? p->depth : ring->entries;
+	unsigned int inflight = 0;
+	unsigned int queued = 0;
+	size_t next = 0;
+	int err = 0;
+
+	while (inflight || (next < len && !err)) {
+		unsigned int head, tail;
+		long ret;
+
+		while (!err && next < len && inflight < depth) {
+			size_t chunk = len - next < p->request_size ? len - next : p->request_size;
+
+			uring_queue(ring, fd, buf + next, chunk, offset + next, write);
+			next += chunk;
+			queued++;
+			inflight++;
+			record_depth(p, inflight);
+		}
+
+		ret = syscall(__NR_io_uring_enter, ring->fd, queued, 1, IORING_ENTER_GETEVENTS, NULL, 0);
+		if (ret == -1 && errno == EINTR)
+			continue;
+		if (ret == -1) {
+			/*
+			 * The kernel still owns the buffers of what it took, so stop
+			 * queueing, take back what it never saw and wait for the rest
+			 * before the caller gets to free or reuse buf.
+			 */
+			if (!err)
+				err = errno;
+			if (queued) {
+				__atomic_store_n(ring->sq_tail, *ring->sq_tail - queued, __ATOMIC_RELEASE);
+				inflight -= queued;
+				queued = 0;
+			} else {
+				usleep(1000);
+			}
+		} else {
+			/* Whatever wasn't consumed stays in the ring for the next call */
+			queued -= ret;
+		}
+
+		head = *ring->cq_head;
+		tail = __atomic_load_n(ring->cq_tail, __ATOMIC_ACQUIRE);
+		for (; head != tail; head++) {
+			struct io_uring_cqe *cqe = &ring->cqes[head & *ring->cq_mask];
+			char *start = (char *)(uintptr_t)cqe->user_data;
+			size_t chunk = len - (start - buf) < p->request_size ? len - (start - buf) : p->request_size;
+
+			inflight--;
+			if (cqe->res < 0) {
+				err = -cqe->res;
+			} else if ((size_t)cqe->res < chunk && !err) {
+				if (transfer_full(fd, start + cqe->res, chunk - cqe->res, offset + (start - buf) + cqe->res,
+				                  write))
+					err = errno;
+			}
+		}
+		__atomic_store_n(ring->cq_head, head, __ATOMIC_RELEASE);
+	}
+
+	if (err) {
+		errno = err;
+		return -1;
+	}
+
+	return 0;
+}
+
+struct pool_job {
+	struct io_pipeline *p;
+	int fd;
+	char *buf;
+	size_t len;
+	off_t offset;
+	bool write;
+	size_t next;
+	unsigned int inflight;
+	int err;
+};
+
+static void *pool_worker(void *arg)
+{
+	struct pool_job *job = arg;
+	struct io_pipeline *p = job->p;
+
+	while (!__atomic_load_n(&job->err, __ATOMIC_RELAXED)) {
+		size_t start = __atomic_fetch_add(&job->next, p->request_size, __ATOMIC_RELAXED);
+		size_t chunk;
+
+		if (start >= job->len)
+			break;
+		chunk = job->len - start < p->request_size ? job->len - start : p->request_size;
+
+		record_depth(p, __atomic_add_fetch(&job->inflight, 1, __ATOMIC_RELAXED));
+		if (transfer_full(job->fd, job->buf + start, chunk, job->offset + start, job->write))
+			__atomic_store_n(&job->err, errno, __ATOMIC_RELAXED);
+		__atomic_sub_fetch(&job->inflight, 1, __ATOMIC_RELAXED);
+	}
+
+	return NULL;
+}
+
+/* Without io_uring, the same amount of requests is kept in flight by blocking threads */
+static int pool_transfer(struct io_pipeline *p, int fd, char *buf, size_t len, off_t offset, bool write)
+{
+	struct pool_job job = {.p = p, .fd = fd, .buf = buf, .len = len, .offset = offset, .write = write};
+	size_t requests = (len + p->request_size - 1) / p->request_size;
+	unsigned int threads = p->depth < requests ? p->depth : requests;
+	pthread_t workers[MAX_POOL_THREADS];
+	unsigned int started;
+
+	if (threads > MAX_POOL_THREADS)
+		threads = MAX_POOL_THREADS;
+
+	for (started = 0; started < threads; started++)
+		if (pthread_create(&workers[started], NULL, pool_worker, &job))
+			break;
+
+	/* Whatever couldn't get a thread is done here */
+	pool_worker(&job);
+
+	for (unsigned int i = 0; i < started; i++)
+		pthread_join(workers[i], NULL);
+
+	if (job.err) {
+		errno = job.err;
+		return -1;
+	}
+
+	return 0;
+}
+
+struct io_pipeline *io_pipeline_open(unsigned int depth, size_t request_size)
+{
+	struct io_pipeline *p = calloc(1, sizeof(*p));
+
+	if (!p)
+		return NULL;
+
+	p->depth = depth ? depth : 1;
+	p->request_size = request_size;
+	p->has_uring = !uring_setup(&p->ring, p->depth);
+
+	return p;
+}
+
+/* Read (or write) len bytes at buf from (or to) fd at offset */
+int io_pipeline_transfer(struct io_pipeline *p, int fd, char *buf, size_t len, off_t offset, bool write)
+{
+	uint64_t start = get_time_ns();
+	int rc;
+
+	if (p->has_uring)
+		rc = uring_transfer(p, fd, buf, len, offset, write);
+	else
+		rc = pool_transfer(p, fd, buf, len, offset, write);
+
+	p->elapsed += get_time_ns() - start;
+	stats_account(write ? STATS_WRITE : STATS_READ, start, rc ? 0 : len);
+	if (!rc)
+		p->bytes += len;
+
+	return rc;
+}
+
+const char *io_pipeline_engine(const struct io_pipeline *p)
+{
+	return p->has_uring ? "io_uring" : "thread pool";
+}
+
+void io_pipeline_close(struct io_pipeline *p, bool verbose)
+{
+	if (verbose)
+		fprintf(stderr, "%s: %jd bytes in %.3f s (%.1f MB/s), queue depth %.1f average, %u max\n",
+		        io_pipeline_engine(p), (intmax_t)p->bytes, p->elapsed / 1e9,
+		        p->elapsed ? p->bytes * 1e3 / p->elapsed : 0.0,
+		        p->depth_samples ? (double)p->depth_sum / p->depth_samples : 0.0, p->max_depth);
+
+	if (p->has_uring)
+		uring_unmap(&p->ring);
+	free(p);
+}
@@ -0,0 +1,243 @@
+#include <ctype.h>
+#include <errno.h>
+#include <getopt.h>
+#include <inttypes.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "mem.h"
+
+#define MAX_HISTOGRAM_VALUES 64
+
+static void do_poll_help(FILE *output)
+{
+	fprintf(output, "Usage:\nmem poll [options] <address> [type]\n\n");
+	fprintf(output, "Wait until a register matches a value, or sample it into a histogram.\n");
+	fprintf(output, "Options:\n");
+	fprintf(output, " -m, --mem-dev\t\t memory device to use (default is /dev/mem)\n");
+	fprintf(output, " -M, --mask\t\t bits of the register to look at (default is all)\n");
+	fprintf(output, " -V, --value\t\t value the masked register must reach (default is 0)\n");
+	fprintf(output, " -n, --not-equal\t wait until the masked register differs from the value instead\n");
+	fprintf(output, " -t, --timeout\t\t give up after this many microseconds (default is 0, never)\n");
+	fprintf(output, " -i, --interval\t\t microseconds between reads (default is 0, busy poll)\n");
+	fprintf(output, " -H, --histogram\t take this many samples and print how often each value was seen\n");
+	fprintf(output, " -h, --help\t\t Display this help screen\n");
+	fprintf(output, "Arguments:\n");
+	fprintf(output, " <address> can be given in decimal, hexedecimal or octal format\n");
+	fprintf(output, " [type] access operation type: [b]yte, [h]alfword, [w]ord (default), [l]ong\n\n");
+	fprintf(output, "Note: base is detect according to the prefix (no-prefix, 0x, and 0).\n");
+}
+
+static inline void cpu_relax(void)
+{
+#if defined(__x86_64__) || defined(__i386__)
+	__builtin_ia32_pause();
+#elif defined(__aarch64__)
+	__asm__ __volatile__("yield");
+#endif
+}
+
+/* Sleep until an absolute CLOCK_MONOTONIC time, as returned by get_time_ns() */
+static void sleep_until(uint64_t when)
+{
+	struct timespec ts = {.tv_sec = when / 1000000000ULL, .tv_nsec = when % 1000000000ULL};
+
+	while (clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &ts, NULL) == EINTR)
+		;
+}
+
+static int poll_value(const char *ptr, char access_type, uint64_t mask, uint64_t value, bool not_equal,
+                      uint64_t timeout_ns, uint64_t interval_ns)
+{
+	uint64_t start = get_time_ns();
+	uint64_t next = start;
+	uint64_t reads = 0;
+	uint64_t now, val;
+
+	for (;;) {
+		val = read_value(ptr, access_type);
+		reads++;
+		now = get_time_ns();
+
+		if (((val & mask) == value) != not_equal) {
+			printf("Matched 0x%" PRIx64 " after %" PRIu64 " ns (%" PRIu64 " reads)\n", val, now - start,
+			       reads);
+			return EXIT_SUCCESS;
+		}
+
+		if (timeout_ns && now - start >= timeout_ns) {
+			printf("Timed out after %" PRIu64 " ns (%" PRIu64 " reads), last value 0x%" PRIx64 "\n",
+			       now - start, reads, val);
+			return EXIT_FAILURE;
+		}
+
+		if (interval_ns) {
+			next += interval_ns;
+			sleep_until(next);
+		} else {
+			cpu_relax();
+		}
+	}
+}
+
+static int histogram_value(const char *ptr, char access_type, uint64_t mask, uint64_t samples, uint64_t interval_ns)
+{
+	struct {
+		uint64_t value;
+		uint64_t count;
+	} bins[MAX_HISTOGRAM_VALUES];
+	uint64_t start = get_time_ns();
+	uint64_t next = start;
+	uint64_t other = 0;
+	uint64_t elapsed;
+	int used = 0;
+	int i;
+
+	for (uint64_t n = 0; n < samples; n++) {
+		uint64_t val = read_value(ptr, access_type) & mask;
+
+		for (i = 0; i < used && bins[i].value != val; i++)
+			;
+		if (i < used) {
+			bins[i].count++;
+		} else if (used < MAX_HISTOGRAM_VALUES) {
+			bins[used].value = val;
+			bins[used++].count = 1;
+		} else {
+			other++;
+		}
+
+		if (interval_ns) {
+			next += interval_ns;
+			sleep_until(next);
+		}
+	}
+	elapsed = get_time_ns() - start;
+
+	printf("%" PRIu64 " samples in %" PRIu64 " ns (%.1f samples/s)\n", samples, elapsed,
+	       elapsed ? samples * 1e9 / elapsed : 0.0);
+	for (i = 0; i < used; i++)
+		printf("0x%-16" PRIx64 " %12" PRIu64 " %6.2f%%\n", bins[i].value, bins[i].count,
+		       100.0 * bins[i].count / samples);
+	if (other)
+		printf("%18s %12" PRIu64 " %6.2f%%\n", "other", other, 100.0 * other / samples);
+
+	return EXIT_SUCCESS;
+}
+
+int do_poll(int argc, char **argv)
+{
+	int c;
+	off_t target;
+	off_t mask = -1;
+	off_t value = 0;
+	off_t timeout = 0;
+	off_t interval = 0;
+	off_t samples = 0;
+	bool not_equal = false;
+	char access_type = 'w';
+	char *memdev = "/dev/mem";
+	struct mapped_mem mem;
+	int rc;
+
+	while (1) {
+		// clang-format off
+		static struct option long_options[] = {
+			{"mem-dev", required_argument, 0, 'm'},
+			{"mask", required_argument, 0, 'M'},
+			{"value", required_argument, 0, 'V'},
+			{"not-equal", no_argument, 0, 'n'},
+			{"timeout", required_argument, 0, 't'},
+			{"interval", required_argument, 0, 'i'},
+			{"histogram", required_argument, 0, 'H'},
+			{"help", no_argument, 0, 'h'},
+			{0, 0, 0, 0}
+		};
+		// clang-format on
+		int option_index = 0;
+		off_t *arg = NULL;
+
+		c = getopt_long(argc, argv, "m:M:V:nt:i:H:h", long_options, &option_index);
+
+		/* Detect the end of the options. */
+		if (c == -1)
+			break;
+
+		switch (c) {
+		case 'm':
+			memdev = optarg;
+			break;
+		case 'M':
+			arg = &mask;
+			break;
+		case 'V':
+			arg = &value;
+			break;
+		case 'n':
+			not_equal = true;
+			break;
+		case 't':
+			arg = &timeout;
+			break;
+		case 'i':
+			arg = &interval;
+			break;
+		case 'H':
+			arg = &samples;
+			break;
+		case 'h':
+			do_poll_help(stdout);
+			return EXIT_SUCCESS;
+		case '?':
+			/* getopt_long already printed an error message. */
+			return EXIT_FAILURE;
+		default:
+			fprintf(stderr, "Unsupported option\n");
+			do_poll_help(stderr);
+			return EXIT_FAILURE;
+			break;
+		}
+
+		if (arg && parse_input(optarg, arg)) {
+			do_poll_help(stderr);
+			return EXIT_FAILURE;
+		}
+	};
+
+	if ((argc - optind < 1) || (argc - optind > 2)) {
+		fprintf(stderr, "Missing address\n");
+		do_poll_help(stderr);
+		return EXIT_FAILURE;
+	}
+
+	if (parse_input(argv[optind], &target)) {
+		do_poll_help(stderr);
+		return EXIT_FAILURE;
+	}
+
+	if (argc - optind > 1) {
+		access_type = tolower(*argv[optind + 1]);
+		if (!access_size(access_type)) {
+			fprintf(stderr, "poll: Unsupported data type %c.\n", access_type);
+			return EXIT_FAILURE;
+		}
+	}
+
+	if (map_memory(memdev, access_size(access_type), PROT_READ, target, &mem))
+		return EXIT_FAILURE;
+
+	if (samples)
+		rc = histogram_value(mem.v_ptr, access_type, mask, samples, interval * 1000);
+	else
+		rc = poll_value(mem.v_ptr, access_type, mask, value & mask, not_equal, timeout * 1000, interval * 1000);
+
+	unmap_memory(&mem);
+
+	return rc;
+}
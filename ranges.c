@@ -0,0 +1,367 @@
+#define _GNU_SOURCE
+#include <errno.h>
+#include <fcntl.h>
+#include <inttypes.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/types.h>
+#include <unistd.h>
+
+#include "mem.h"
+
+/*
+ * A range container holds many ranges in one file: a header, one fixed size
+ * entry per range sorted by address, then the data of every range at the
+ * offset recorded in its entry.
+ */
+#define CONTAINER_MAGIC "MEMRNGS1"
+#define CONTAINER_NAME_LEN 64
+#define RANGE_NAME_RESERVED ",\"\\/"
+
+struct container_header {
+	char magic[8];
+	uint64_t count;
+};
+
+struct container_entry {
+	uint64_t address;
+	uint64_t length;
+	uint64_t offset;
+	char name[CONTAINER_NAME_LEN];
+};
+
+struct range_container {
+	int fd;
+	uint64_t count;
+	struct container_entry *entries;
+};
+
+static int compare_address(const void *a, const void *b)
+{
+	const struct mem_range *x = a;
+	const struct mem_range *y = b;
+
+	if (x->address != y->address)
+		return x->address < y->address ? -1 : 1;
+	if (x->length != y->length)
+		return x->length < y->length ? -1 : 1;
+
+	return 0;
+}
+
+static int compare_label(const void *a, const void *b)
+{
+	const struct mem_range *const *x = a;
+	const struct mem_range *const *y = b;
+	char x_label[32], y_label[32];
+
+	return strcmp(range_label(*x, x_label, sizeof(x_label)), range_label(*y, y_label, sizeof(y_label)));
+}
+
+/*
+ * Labels name the output of a range, files of store -D included, so two
+ * ranges must never share one. Unnamed ranges are labelled by their address.
+ */
+static int check_labels(const char *path, const struct range_list *list)
+{
+	const struct mem_range **sorted = malloc(list->count * sizeof(*sorted));
+	char label[32];
+	int rc = 0;
+
+	if (!sorted)
+		return -1;
+
+	for (int i = 0; i < list->count; i++)
+		sorted[i] = &list->ranges[i];
+	qsort(sorted, list->count, sizeof(*sorted), compare_label);
+	for (int i = 1; i < list->count; i++) {
+		if (!compare_label(&sorted[i - 1], &sorted[i])) {
+			fprintf(stderr, "%s: more than one range labelled %s, name them apart\n", path,
+			        range_label(sorted[i], label, sizeof(label)));
+			rc = -1;
+			break;
+		}
+	}
+	free(sorted);
+
+	return rc;
+}
+
+/*
+ * Read a range list: one "<address> <length> [name]" per line, blank lines
+ * and everything after a '#' ignored. The ranges come back sorted by address.
+ */
+int range_list_load(const char *path, struct range_list *list)
+{
+	FILE *f = strcmp(path, "-") ? fopen(path, "r") : stdin;
+	char *line = NULL;
+	size_t line_size = 0;
+	int lineno = 0;
+	int rc = 0;
+
+	memset(list, 0, sizeof(*list));
+	if (!f) {
+		perror("Can't open range list");
+		return -1;
+	}
+
+	while (getline(&line, &line_size, f) != -1) {
+		char *save = NULL;
+		char *addr, *len, *name;
+		struct mem_range *grown;
+		struct mem_range r = {0};
+
+		lineno++;
+		line[strcspn(line, "#\n")] = '\0';
+		addr = strtok_r(line, " \t", &save);
+		if (!addr)
+			continue;
+		len = strtok_r(NULL, " \t", &save);
+		name = strtok_r(NULL, " \t", &save);
+
+		if (!len || strtok_r(NULL, " \t", &save) || parse_input(addr, &r.address) || parse_input(len, &r.length) ||
+		    r.length <= 0) {
+			fprintf(stderr, "%s:%d: expected <address> <length> [name]\n", path, lineno);
+			rc = -1;
+			break;
+		}
+		if (name && strlen(name) >= CONTAINER_NAME_LEN) {
+			fprintf(stderr, "%s:%d: range name longer than %d characters\n", path, lineno,
+			        CONTAINER_NAME_LEN - 1);
+			rc = -1;
+			break;
+		}
+		/* Names end up unquoted in CSV and manifest fields, and as file names */
+		if (name && name[strcspn(name, RANGE_NAME_RESERVED)]) {
+			fprintf(stderr, "%s:%d: range name can't contain any of %s\n", path, lineno,
+			        RANGE_NAME_RESERVED);
+			rc = -1;
+			break;
+		}
+
+		r.name = name ? strdup(name) : NULL;
+		grown = realloc(list->ranges, (list->count + 1) * sizeof(*list->ranges));
+		if (!grown || (name && !r.name)) {
+			free(r.name);
+			rc = -1;
+			break;
+		}
+		list->ranges = grown;
+		list->ranges[list->count++] = r;
+	}
+
+	free(line);
+	if (f != stdin)
+		fclose(f);
+
+	if (!rc && !list->count) {
+		fprintf(stderr, "%s: no ranges\n", path);
+		rc = -1;
+	}
+	if (rc) {
+		range_list_free(list);
+		return -1;
+	}
+
+	qsort(list->ranges, list->count, sizeof(*list->ranges), compare_address);
+	if (check_labels(path, list)) {
+		range_list_free(list);
+		return -1;
+	}
+
+	return 0;
+}
+
+/*
+ * Map every range. Ranges that overlap or share a page are coalesced into one
+ * span, and every span is a single mapping however many ranges it holds.
+ */
+int range_list_map(struct range_list *list, char *memdev, int props)
+{
+	off_t page_size = sysconf(_SC_PAGESIZE);
+
+	list->spans = calloc(list->count, sizeof(*list->spans));
+	if (!list->spans)
+		return -1;
+
+	for (int i = 0; i < list->count;) {
+		off_t start = list->ranges[i].address;
+		off_t end = start + list->ranges[i].length;
+		struct mapped_mem *span = &list->spans[list->span_count];
+		int first = i;
+
+		for (i++; i < list->count && list->ranges[i].address <= ((end + page_size - 1) & ~(page_size - 1)); i++)
+			if (list->ranges[i].address + list->ranges[i].length > end)
+				end = list->ranges[i].address + list->ranges[i].length;
+
+		if (map_memory(memdev, end - start, props, start, span))
+			return -1;
+		list->span_count++;
+
+		for (int j = first; j < i; j++)
+			list->ranges[j].data = span->v_ptr + (list->ranges[j].address - start);
+	}
+
+	return 0;
+}
+
+void range_list_free(struct range_list *list)
+{
+	for (int i = 0; i < list->span_count; i++)
+		unmap_memory(&list->spans[i]);
+	for (int i = 0; i < list->count; i++)
+		free(list->ranges[i].name);
+	free(list->spans);
+	free(list->ranges);
+	memset(list, 0, sizeof(*list));
+}
+
+/* The name of the range, or its address when it has none */
+const char *range_label(const struct mem_range *r, char *buf, size_t len)
+{
+	if (r->name)
+		return r->name;
+
+	snprintf(buf, len, "0x%jx", (intmax_t)r->address);
+	return buf;
+}
+
+struct container_job {
+	int fd;
+	const struct range_list *list;
+	const struct container_entry *entries;
+};
+
+static int store_container_range(int index, void *arg)
+{
+	struct container_job *job = arg;
+	const struct mem_range *r = &job->list->ranges[index];
+	off_t offset = job->entries[index].offset;
+
+	for (off_t done = 0; done < r->length;) {
+		ssize_t ret = pwrite(job->fd, r->data + done, r->length - done, offset + done);
+
+		if (ret == -1 && errno == EINTR)
+			continue;
+		if (ret <= 0)
+			return -1;
+		done += ret;
+	}
+
+	return 0;
+}
+
+/* Write every (mapped) range of the list to fd as one container */
+int range_container_store(int fd, const struct range_list *list, int threads)
+{
+	struct container_header header = {.count = list->count};
+	struct container_entry *entries = calloc(list->count, sizeof(*entries));
+	struct container_job job = {.fd = fd, .list = list, .entries = entries};
+	off_t offset = sizeof(header) + list->count * sizeof(*entries);
+	ssize_t index_size = list->count * sizeof(*entries);
+	int rc = -1;
+
+	if (!entries)
+		return -1;
+
+	memcpy(header.magic, CONTAINER_MAGIC, sizeof(header.magic));
+	for (int i = 0; i < list->count; i++) {
+		entries[i].address = list->ranges[i].address;
+		entries[i].length = list->ranges[i].length;
+		entries[i].offset = offset;
+		if (list->ranges[i].name)
+			strcpy(entries[i].name, list->ranges[i].name);
+		offset += list->ranges[i].length;
+	}
+
+	if (pwrite(fd, &header, sizeof(header), 0) == sizeof(header) &&
+	    pwrite(fd, entries, index_size, sizeof(header)) == index_size &&
+	    !run_parallel(list->count, threads, store_container_range, &job) && !ftruncate(fd, offset))
+		rc = 0;
+
+	free(entries);
+
+	return rc;
+}
+
+struct range_container *range_container_open(const char *path)
+{
+	struct range_container *c = calloc(1, sizeof(*c));
+	struct container_header header;
+	uint64_t data_start;
+	struct stat st;
+
+	if (!c)
+		return NULL;
+
+	c->fd = open(path, O_RDONLY);
+	if (c->fd == -1) {
+		perror("Can't open range container");
+		free(c);
+		return NULL;
+	}
+
+	if (fstat(c->fd, &st) || pread(c->fd, &header, sizeof(header), 0) != sizeof(header) ||
+	    memcmp(header.magic, CONTAINER_MAGIC, sizeof(header.magic))) {
+		fprintf(stderr, "%s is not a range container\n", path);
+		range_container_close(c);
+		return NULL;
+	}
+
+	/* The index has to fit the file before its size can be trusted */
+	if (header.count > (st.st_size - sizeof(header)) / sizeof(*c->entries)) {
+		fprintf(stderr, "%s: index of %" PRIu64 " ranges past the end of the file\n", path, header.count);
+		range_container_close(c);
+		return NULL;
+	}
+
+	c->count = header.count;
+	c->entries = malloc(c->count * sizeof(*c->entries));
+	if (!c->entries ||
+	    pread(c->fd, c->entries, c->count * sizeof(*c->entries), sizeof(header)) !=
+	        (ssize_t)(c->count * sizeof(*c->entries))) {
+		fprintf(stderr, "Can't read the index of %s\n", path);
+		range_container_close(c);
+		return NULL;
+	}
+
+	/* Data mapped past the end of the file would fault instead of failing */
+	data_start = sizeof(header) + c->count * sizeof(*c->entries);
+	for (uint64_t i = 0; i < c->count; i++) {
+		const struct container_entry *e = &c->entries[i];
+
+		if (e->offset < data_start || e->offset > (uint64_t)st.st_size ||
+		    e->length > (uint64_t)st.st_size - e->offset) {
+			fprintf(stderr, "%s: data of range %" PRIu64 " is outside the container\n", path, i);
+			range_container_close(c);
+			return NULL;
+		}
+	}
+
+	return c;
+}
+
+/* Map the data the container holds for exactly the range r */
+int range_container_map(const struct range_container *c, const struct mem_range *r, struct mapped_mem *mem)
+{
+	for (uint64_t i = 0; i < c->count; i++)
+		if (c->entries[i].address == (uint64_t)r->address && c->entries[i].length == (uint64_t)r->length)
+			return map_memory_fd(c->fd, r->length, PROT_READ, c->entries[i].offset, mem);
+
+	return 1;
+}
+
+void range_container_close(struct range_container *c)
+{
+	if (!c)
+		return;
+
+	close(c->fd);
+	free(c->entries);
+	free(c);
+}
@@ -0,0 +1,177 @@
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <string.h>
+
+#include "mem.h"
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <immintrin.h>
+#define HAVE_X86_SIMD 1
+#endif
+
+typedef size_t (*scan_func)(const char *a, const char *b, size_t len, bool want_equal);
+
+static size_t scan_scalar(const char *a, const char *b, size_t len, bool want_equal)
+{
+	size_t i = 0;
+
+	/* Looking for a mismatch can skip whole equal words */
+	if (!want_equal)
+		for (; i + sizeof(uint64_t) <= len; i += sizeof(uint64_t)) {
+			uint64_t x, y;
+
+			memcpy(&x, a + i, sizeof(x));
+			memcpy(&y, b + i, sizeof(y));
+			if (x != y)
+				break;
+		}
+
+	for (; i < len; i++)
+		if ((a[i] == b[i]) == want_equal)
+			break;
+
+	return i;
+}
+
+#ifdef HAVE_X86_SIMD
+__attribute__((target("sse2"))) static size_t scan_sse2(const char *a, const char *b, size_t len, bool want_equal)
+{
+	unsigned int miss = want_equal ? 0 : 0xffff;
+	size_t i;
+
+	for (i = 0; i + 16 <= len; i += 16) {
+		__m128i x = _mm_loadu_si128((const __m128i *)(a + i));
+		__m128i y = _mm_loadu_si128((const __m128i *)(b + i));
+		unsigned int mask = _mm_movemask_epi8(_mm_cmpeq_epi8(x, y));
+
+		if (mask != miss)
+			return i + __builtin_ctz(want_equal ? mask : ~mask);
+	}
+
+	return i + scan_scalar(a + i, b + i, len - i, want_equal);
+}
+
+__attribute__((target("avx2"))) static size_t scan_avx2(const char *a, const char *b, size_t len, bool want_equal)
+{
+	unsigned int miss = want_equal ? 0 : 0xffffffff;
+	size_t i;
+
+	for (i = 0; i + 32 <= len; i += 32) {
+		__m256i x = _mm256_loadu_si256((const __m256i *)(a + i));
+		__m256i y = _mm256_loadu_si256((const __m256i *)(b + i));
+		unsigned int mask = _mm256_movemask_epi8(_mm256_cmpeq_epi8(x, y));
+
+		if (mask != miss)
+			return i + __builtin_ctz(want_equal ? mask : ~mask);
+	}
+
+	return i + scan_scalar(a + i, b + i, len - i, want_equal);
+}
+#endif
+
+static scan_func select_scan(void)
+{
+#ifdef HAVE_X86_SIMD
+	__builtin_cpu_init();
+	if (__builtin_cpu_supports("avx2"))
+		return scan_avx2;
+	if (__builtin_cpu_supports("sse2"))
+		return scan_sse2;
+#endif
+	return scan_scalar;
+}
+
+/*
+ * Return the offset of the first byte where (a[i] == b[i]) equals want_equal,
+ * or len if there is none. The fastest kernel the CPU supports is picked on
+ * first use.
+ */
+size_t mem_scan(const char *a, const char *b, size_t len, bool want_equal)
+{
+	static scan_func scan;
+
+	if (!scan)
+		scan = select_scan();
+
+	return scan(a, b, len, want_equal);
+}
+
+typedef bool (*zero_func)(const char *p, size_t len);
+
+static bool zero_scalar(const char *p, size_t len)
+{
+	uint64_t acc = 0;
+	size_t i = 0;
+
+	for (; i + sizeof(uint64_t) <= len; i += sizeof(uint64_t)) {
+		uint64_t x;
+
+		memcpy(&x, p + i, sizeof(x));
+		acc |= x;
+	}
+	for (; i < len; i++)
+		acc |= (uint8_t)p[i];
+
+	return !acc;
+}
+
+#ifdef HAVE_X86_SIMD
+__attribute__((target("sse2"))) static bool zero_sse2(const char *p, size_t len)
+{
+	__m128i acc = _mm_setzero_si128();
+	size_t i;
+
+	for (i = 0; i + 64 <= len; i += 64) {
+		acc = _mm_or_si128(acc, _mm_loadu_si128((const __m128i *)(p + i)));
+		acc = _mm_or_si128(acc, _mm_loadu_si128((const __m128i *)(p + i + 16)));
+		acc = _mm_or_si128(acc, _mm_loadu_si128((const __m128i *)(p + i + 32)));
+		acc = _mm_or_si128(acc, _mm_loadu_si128((const __m128i *)(p + i + 48)));
+		/* Stop at the first 4KB holding data */
+		if (!(i & 4095) && _mm_movemask_epi8(_mm_cmpeq_epi8(acc, _mm_setzero_si128())) != 0xffff)
+			return false;
+	}
+
+	return _mm_movemask_epi8(_mm_cmpeq_epi8(acc, _mm_setzero_si128())) == 0xffff && zero_scalar(p + i, len - i);
+}
+
+__attribute__((target("avx2"))) static bool zero_avx2(const char *p, size_t len)
+{
+	__m256i acc = _mm256_setzero_si256();
+	size_t i;
+
+	for (i = 0; i + 128 <= len; i += 128) {
+		acc = _mm256_or_si256(acc, _mm256_loadu_si256((const __m256i *)(p + i)));
+		acc = _mm256_or_si256(acc, _mm256_loadu_si256((const __m256i *)(p + i + 32)));
+		acc = _mm256_or_si256(acc, _mm256_loadu_si256((const __m256i *)(p + i + 64)));
+		acc = _mm256_or_si256(acc, _mm256_loadu_si256((const __m256i *)(p + i + 96)));
+		if (!(i & 4095) && !_mm256_testz_si256(acc, acc))
+			return false;
+	}
+
+	return _mm256_testz_si256(acc, acc) && zero_scalar(p + i, len - i);
+}
+#endif
+
+static zero_func select_zero(void)
+{
+#ifdef HAVE_X86_SIMD
+	__builtin_cpu_init();
+	if (__builtin_cpu_supports("avx2"))
+		return zero_avx2;
+	if (__builtin_cpu_supports("sse2"))
+		return zero_sse2;
+#endif
+	return zero_scalar;
+}
+
+/* Return whether all len bytes at p are zero */
+bool mem_is_zero(const char *p, size_t len)
+{
+	static zero_func zero;
+
+	if (!zero)
+		zero = select_zero();
+
+	return zero(p, len);
+}
@@ -0,0 +1,202 @@
+#ifdef HAVE_CONFIG_H
+#include "config.h"
+#endif
+
+#include <ctype.h>
+#include <getopt.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#ifdef HAVE_READLINE_READLINE_H
+#include <readline/history.h>
+#include <readline/readline.h>
+#endif
+
+#include "mem.h"
+
+#define MAX_LINE 4096
+#define MAX_ARGS 64
+
+static void do_shell_help(FILE *output)
+{
+	fprintf(output, "Usage:\nmem shell [options] [script]\n\n");
+	fprintf(output, "Run mem commands from an interactive prompt, a script or standard input.\n");
+	fprintf(output, "The memory device stays open and mappings stay cached between commands.\n");
+	fprintf(output, "Options:\n");
+	fprintf(output, " -e, --exit-on-error\t Stop at the first failing command\n");
+	fprintf(output, " -t, --time\t\t Report how long each command took\n");
+	fprintf(output, " -h, --help\t\t Display this help screen\n");
+	fprintf(output, "Commands:\n");
+	fprintf(output, " Any mem command without the leading \"mem\", plus \"exit\" and \"quit\".\n");
+	fprintf(output, " Lines starting with '#' are ignored.\n");
+}
+
+/* Split a line in place on white space, honouring single and double quotes */
+static int split_line(char *line, char **args, int max_args)
+{
+	int count = 0;
+	char *src = line, *dst = line;
+
+	while (*src) {
+		char quote = 0;
+
+		while (isspace((unsigned char)*src))
+			src++;
+		if (!*src || *src == '#')
+			break;
+		if (count == max_args - 1)
+			return -1;
+
+		args[count++] = dst;
+		while (*src && (quote || !isspace((unsigned char)*src))) {
+			if (!quote && (*src == '"' || *src == '\''))
+				quote = *src++;
+			else if (quote && *src == quote)
+				quote = 0, src++;
+			else
+				*dst++ = *src++;
+		}
+		if (*src)
+			src++;
+		*dst++ = '\0';
+	}
+	args[count] = NULL;
+
+	return count;
+}
+
+static char *read_command(FILE *in, bool interactive, char *buf)
+{
+#ifdef HAVE_READLINE_READLINE_H
+	if (interactive) {
+		char *line = readline("mem> ");
+
+		if (!line)
+			return NULL;
+		if (*line)
+			add_history(line);
+		strncpy(buf, line, MAX_LINE - 1);
+		buf[MAX_LINE - 1] = '\0';
+		free(line);
+		return buf;
+	}
+#endif
+	if (interactive) {
+		printf("mem> ");
+		fflush(stdout);
+	}
+
+	return fgets(buf, MAX_LINE, in);
+}
+
+int do_shell(int argc, char **argv)
+{
+	int c;
+	bool exit_on_error = false;
+	bool timing = false;
+	bool interactive;
+	int rc = EXIT_SUCCESS;
+	char line[MAX_LINE];
+	char *args[MAX_ARGS];
+	FILE *in = stdin;
+
+	while (1) {
+		// clang-format off
+		static struct option long_options[] = {
+			{"exit-on-error", no_argument, 0, 'e'},
+			{"time", no_argument, 0, 't'},
+			{"help", no_argument, 0, 'h'},
+			{0, 0, 0, 0}
+		};
+		// clang-format on
+		int option_index = 0;
+
+		c = getopt_long(argc, argv, "eth", long_options, &option_index);
+
+		/* Detect the end of the options. */
+		if (c == -1)
+			break;
+
+		switch (c) {
+		case 'e':
+			exit_on_error = true;
+			break;
+		case 't':
+			timing = true;
+			break;
+		case 'h':
+			do_shell_help(stdout);
+			return EXIT_SUCCESS;
+		case '?':
+			/* getopt_long already printed an error message. */
+			return EXIT_FAILURE;
+		default:
+			fprintf(stderr, "Unsupported option\n");
+			do_shell_help(stderr);
+			return EXIT_FAILURE;
+			break;
+		}
+	};
+
+	if (argc - optind > 1) {
+		fprintf(stderr, "Too many arguments\n");
+		do_shell_help(stderr);
+		return EXIT_FAILURE;
+	}
+
+	if (argc - optind == 1 && strcmp(argv[optind], "-")) {
+		in = fopen(argv[optind], "r");
+		if (!in) {
+			perror("Can't open script");
+			return EXIT_FAILURE;
+		}
+	}
+	interactive = in == stdin && isatty(STDIN_FILENO);
+
+	while (read_command(in, interactive, line)) {
+		uint64_t start;
+		int count, ret;
+
+		line[strcspn(line, "\n")] = '\0';
+		count = split_line(line, args, MAX_ARGS);
+		if (count < 0) {
+			fprintf(stderr, "Too many arguments\n");
+			continue;
+		}
+		if (!count)
+			continue;
+		if (!strcmp(args[0], "exit") || !strcmp(args[0], "quit"))
+			break;
+		/* Resolved like do_cmd() does, which takes any name starting with a command */
+		if (find_cmd(args[0]) == do_shell) {
+			fprintf(stderr, "Already in a shell\n");
+			continue;
+		}
+
+		/* Every command parses its own options from scratch */
+		optind = 0;
+		start = get_time_ns();
+		ret = do_cmd(count, args);
+		fflush(stdout);
+		if (timing)
+			fprintf(stderr, "%s: %.3f us\n", args[0], (get_time_ns() - start) / 1e3);
+
+		if (ret != EXIT_SUCCESS) {
+			rc = EXIT_FAILURE;
+			if (exit_on_error)
+				break;
+		}
+	}
+
+	if (interactive)
+		putchar('\n');
+	if (in != stdin)
+		fclose(in);
+	map_cache_flush();
+
+	return rc;
+}
@@ -0,0 +1,360 @@
+#include <errno.h>
+#include <fcntl.h>
+#include <inttypes.h>
+#include <limits.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include "mem.h"
+
+/*
+ * Content addressed snapshot store.
+ *
+ * <dir>/chunks.pack holds every distinct chunk once, appended in the order
+ * they were first seen. <dir>/chunks.idx lists (sha256, pack offset) for each
+ * of them. A snapshot index is a header followed by the pack offset of every
+ * chunk of the captured range, so a snapshot only costs the chunks that
+ * changed since any earlier one plus 8 bytes per chunk.
+ */
+
+#define SNAPSHOT_MAGIC "MEMSNAP1"
+
+struct snapshot_header {
+	char magic[8];
+	uint64_t address;
+	uint64_t length;
+	uint64_t chunk_size;
+	uint64_t count;
+};
+
+struct chunk_entry {
+	uint8_t hash[32];
+	uint64_t offset;
+};
+
+struct snapshot {
+	int pack_fd;
+	int idx_fd;
+	off_t pack_size;
+	struct snapshot_header header;
+	uint64_t *offsets;
+	uint64_t done;
+	uint64_t new_chunks;
+	/* Open addressing table of every chunk in the store */
+	struct chunk_entry *table;
+	size_t table_size;
+	size_t table_used;
+	/* Index records of the chunks added by one snapshot_add() call */
+	struct chunk_entry *pending;
+	size_t pending_size;
+	char *pad;
+};
+
+static size_t table_slot(const struct snapshot *snap, const uint8_t *hash)
+{
+	uint64_t key;
+
+	memcpy(&key, hash, sizeof(key));
+	return key & (snap->table_size - 1);
+}
+
+static void table_insert(struct snapshot *snap, const struct chunk_entry *entry)
+{
+	size_t i = table_slot(snap, entry->hash);
+
+	while (snap->table[i].offset != UINT64_MAX)
+		i = (i + 1) & (snap->table_size - 1);
+	snap->table[i] = *entry;
+	snap->table_used++;
+}
+
+static int table_grow(struct snapshot *snap)
+{
+	struct chunk_entry *old = snap->table;
+	size_t old_size = snap->table_size;
+
+	snap->table_size = old_size ? old_size * 2 : 1024;
+	snap->table = malloc(snap->table_size * sizeof(*snap->table));
+	if (!snap->table) {
+		snap->table = old;
+		snap->table_size = old_size;
+		return -1;
+	}
+	memset(snap->table, 0xff, snap->table_size * sizeof(*snap->table));
+
+	snap->table_used = 0;
+	for (size_t i = 0; i < old_size; i++)
+		if (old[i].offset != UINT64_MAX)
+			table_insert(snap, &old[i]);
+	free(old);
+
+	return 0;
+}
+
+static const struct chunk_entry *table_find(const struct snapshot *snap, const uint8_t *hash)
+{
+	size_t i = table_slot(snap, hash);
+
+	for (; snap->table[i].offset != UINT64_MAX; i = (i + 1) & (snap->table_size - 1))
+		if (!memcmp(snap->table[i].hash, hash, sizeof(snap->table[i].hash)))
+			return &snap->table[i];
+
+	return NULL;
+}
+
+static int table_add(struct snapshot *snap, const struct chunk_entry *entry)
+{
+	/* Keep the load factor under one half */
+	if ((snap->table_used + 1) * 2 > snap->table_size && table_grow(snap))
+		return -1;
+	table_insert(snap, entry);
+
+	return 0;
+}
+
+static int open_in(const char *dir, const char *name, int flags)
+{
+	char path[PATH_MAX];
+
+	snprintf(path, sizeof(path), "%s/%s", dir, name);
+	return open(path, flags, 0644);
+}
+
+/*
+ * Records are appended in pack order, so a record torn by an interrupted
+ * capture, or one whose chunk never made it into the pack, starts the tail
+ * that is dropped. A chunk of another capture's size is checked against the
+ * current one, which at worst drops a valid record and stores its chunk again.
+ */
+static int load_chunk_index(struct snapshot *snap)
+{
+	struct chunk_entry entry;
+	off_t valid = 0;
+	ssize_t ret;
+
+	if (table_grow(snap))
+		return -1;
+
+	while ((ret = read_full(snap->idx_fd, &entry, sizeof(entry))) == sizeof(entry)) {
+		if (entry.offset > (uint64_t)snap->pack_size ||
+		    snap->header.chunk_size > (uint64_t)snap->pack_size - entry.offset)
+			break;
+		if (table_add(snap, &entry))
+			return -1;
+		valid += sizeof(entry);
+	}
+	if (ret < 0)
+		return -1;
+
+	if (ftruncate(snap->idx_fd, valid) || lseek(snap->idx_fd, valid, SEEK_SET) == -1)
+		return -1;
+
+	return 0;
+}
+
+void snapshot_free(struct snapshot *snap)
+{
+	if (!snap)
+		return;
+	if (snap->pack_fd != -1)
+		close(snap->pack_fd);
+	if (snap->idx_fd != -1)
+		close(snap->idx_fd);
+	free(snap->offsets);
+	free(snap->table);
+	free(snap->pending);
+	free(snap->pad);
+	free(snap);
+}
+
+struct snapshot *snapshot_open(const char *dir, off_t address, off_t length, off_t chunk_size)
+{
+	struct snapshot *snap;
+
+	if (mkdir(dir, 0755) == -1 && errno != EEXIST) {
+		perror("Can't create snapshot store");
+		return NULL;
+	}
+
+	snap = calloc(1, sizeof(*snap));
+	if (!snap)
+		return NULL;
+
+	snap->pack_fd = open_in(dir, "chunks.pack", O_RDWR | O_CREAT);
+	snap->idx_fd = open_in(dir, "chunks.idx", O_RDWR | O_CREAT);
+	if (snap->pack_fd == -1 || snap->idx_fd == -1) {
+		perror("Can't open snapshot store");
+		snapshot_free(snap);
+		return NULL;
+	}
+
+	memcpy(snap->header.magic, SNAPSHOT_MAGIC, sizeof(snap->header.magic));
+	snap->header.address = address;
+	snap->header.length = length;
+	snap->header.chunk_size = chunk_size;
+	snap->header.count = (length + chunk_size - 1) / chunk_size;
+
+	snap->offsets = malloc(snap->header.count * sizeof(*snap->offsets));
+	snap->pad = calloc(1, chunk_size);
+	snap->pack_size = lseek(snap->pack_fd, 0, SEEK_END);
+	if (!snap->offsets || !snap->pad || snap->pack_size == -1 || load_chunk_index(snap)) {
+		fprintf(stderr, "Can't load snapshot store index\n");
+		snapshot_free(snap);
+		return NULL;
+	}
+
+	return snap;
+}
+
+/* Add the next len bytes of the range, len is a multiple of the chunk size but for the last call */
+int snapshot_add(struct snapshot *snap, const char *data, size_t len)
+{
+	size_t chunk_size = snap->header.chunk_size;
+	size_t chunks = (len + chunk_size - 1) / chunk_size;
+	size_t pending = 0;
+	ssize_t idx_len;
+
+	if (chunks > snap->pending_size) {
+		struct chunk_entry *grown = realloc(snap->pending, chunks * sizeof(*grown));
+
+		if (!grown) {
+			perror("Failed writing snapshot chunk");
+			return -1;
+		}
+		snap->pending = grown;
+		snap->pending_size = chunks;
+	}
+
+	for (size_t pos = 0; pos < len; pos += chunk_size) {
+		const char *chunk = data + pos;
+		struct chunk_entry entry;
+		const struct chunk_entry *found;
+
+		/* A short tail chunk is stored zero padded */
+		if (len - pos < chunk_size) {
+			memset(snap->pad, 0, chunk_size);
+			memcpy(snap->pad, chunk, len - pos);
+			chunk = snap->pad;
+		}
+
+		sha256((const uint8_t *)chunk, chunk_size, entry.hash);
+		found = table_find(snap, entry.hash);
+		if (found) {
+			snap->offsets[snap->done++] = found->offset;
+			continue;
+		}
+
+		entry.offset = snap->pack_size;
+		if (write_full(snap->pack_fd, chunk, chunk_size) != chunk_size || table_add(snap, &entry)) {
+			perror("Failed writing snapshot chunk");
+			return -1;
+		}
+		snap->pack_size += chunk_size;
+		snap->offsets[snap->done++] = entry.offset;
+		snap->pending[pending++] = entry;
+		snap->new_chunks++;
+	}
+
+	if (!pending)
+		return 0;
+
+	/* No record may reach the disk before the chunk it points at */
+	idx_len = pending * sizeof(*snap->pending);
+	if (fdatasync(snap->pack_fd) || write_full(snap->idx_fd, snap->pending, idx_len) != idx_len) {
+		perror("Failed writing snapshot chunk index");
+		return -1;
+	}
+
+	return 0;
+}
+
+/* Write the snapshot index and release the store */
+int snapshot_finish(struct snapshot *snap, const char *index_path, bool verbose)
+{
+	size_t len = snap->header.count * sizeof(*snap->offsets);
+	int rc = 0;
+	int fd;
+
+	if (snap->done != snap->header.count) {
+		fprintf(stderr, "Snapshot is incomplete\n");
+		snapshot_free(snap);
+		return -1;
+	}
+
+	/* snapshot_add() synced the chunks, their records follow them to disk */
+	fdatasync(snap->idx_fd);
+
+	fd = open(index_path, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+	if (fd == -1 || write_full(fd, &snap->header, sizeof(snap->header)) != sizeof(snap->header) ||
+	    write_full(fd, snap->offsets, len) != len) {
+		perror("Failed writing snapshot index");
+		rc = -1;
+	}
+	if (fd != -1)
+		close(fd);
+
+	if (verbose && !rc)
+		fprintf(stderr, "Snapshot of %" PRIu64 " chunks, %" PRIu64 " new (%" PRIu64 " bytes written)\n",
+		        snap->header.count, snap->new_chunks, snap->new_chunks * snap->header.chunk_size);
+
+	snapshot_free(snap);
+
+	return rc;
+}
+
+/* Turn a snapshot back into the flat image it was captured from */
+int snapshot_rebuild(const char *dir, const char *index_path, int out_fd)
+{
+	struct snapshot_header header;
+	uint64_t offset, remaining;
+	char *chunk = NULL;
+	int index_fd, pack_fd;
+	int rc = -1;
+
+	index_fd = open(index_path, O_RDONLY);
+	pack_fd = open_in(dir, "chunks.pack", O_RDONLY);
+	if (index_fd == -1 || pack_fd == -1) {
+		perror("Can't open snapshot");
+		goto out;
+	}
+
+	if (read_full(index_fd, &header, sizeof(header)) != sizeof(header) ||
+	    memcmp(header.magic, SNAPSHOT_MAGIC, sizeof(header.magic)) || !header.chunk_size) {
+		fprintf(stderr, "%s is not a snapshot index\n", index_path);
+		goto out;
+	}
+
+	chunk = malloc(header.chunk_size);
+	if (!chunk)
+		goto out;
+
+	for (remaining = header.length; remaining; remaining -= header.chunk_size < remaining ? header.chunk_size
+	                                                                                      : remaining) {
+		size_t len = header.chunk_size < remaining ? header.chunk_size : remaining;
+
+		if (read_full(index_fd, &offset, sizeof(offset)) != sizeof(offset) ||
+		    pread(pack_fd, chunk, header.chunk_size, offset) != header.chunk_size) {
+			fprintf(stderr, "Snapshot %s is truncated or its store is damaged\n", index_path);
+			goto out;
+		}
+		if (write_full(out_fd, chunk, len) != len) {
+			perror("Failed writing image");
+			goto out;
+		}
+	}
+	rc = 0;
+
+out:
+	free(chunk);
+	if (index_fd != -1)
+		close(index_fd);
+	if (pack_fd != -1)
+		close(pack_fd);
+
+	return rc;
+}
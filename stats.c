@@ -0,0 +1,248 @@
+#define _GNU_SOURCE
+#include <inttypes.h>
+#include <linux/perf_event.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <string.h>
+#include <sys/ioctl.h>
+#include <sys/resource.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+
+#include "mem.h"
+
+/*
+ * --stats instrumentation. Mapping, unmapping and file I/O account the time
+ * they take wherever they happen. Parsing is everything before the first of
+ * those, and the kernel of the command is what is left of the wall clock time.
+ * Phases that run on several threads at once add up the time of every thread.
+ */
+enum stats_format {
+	STATS_OFF,
+	STATS_TEXT,
+	STATS_JSON,
+};
+
+// clang-format off
+static const struct counter {
+	const char *name;
+	uint32_t type;
+	uint64_t config;
+	} counters[] = {
+		{"cycles", PERF_TYPE_HARDWARE, PERF_COUNT_HW_CPU_CYCLES},
+		{"llc_misses", PERF_TYPE_HW_CACHE, PERF_COUNT_HW_CACHE_LL |
+		                                   (PERF_COUNT_HW_CACHE_OP_READ << 8) |
+		                                   (PERF_COUNT_HW_CACHE_RESULT_MISS << 16)},
+		{"dtlb_misses", PERF_TYPE_HW_CACHE, PERF_COUNT_HW_CACHE_DTLB |
+		                                    (PERF_COUNT_HW_CACHE_OP_READ << 8) |
+		                                    (PERF_COUNT_HW_CACHE_RESULT_MISS << 16)},
+	};
+// clang-format on
+
+#define COUNTER_COUNT (sizeof(counters) / sizeof(counters[0]))
+
+static const char *const phase_names[] = {"map", "unmap", "read", "write", "access"};
+
+static struct stats {
+	enum stats_format format;
+	const char *cmd;
+	uint64_t start;
+	/* When the first mapping or I/O started, 0 until then */
+	uint64_t parse_end;
+	uint64_t phase_ns[STATS_PHASES];
+	uint64_t phase_bytes[STATS_PHASES];
+	struct rusage usage;
+	int counter_fd[COUNTER_COUNT];
+} stats;
+
+int stats_enable(const char *format)
+{
+	if (!format || !strcmp(format, "text")) {
+		stats.format = STATS_TEXT;
+	} else if (!strcmp(format, "json")) {
+		stats.format = STATS_JSON;
+	} else {
+		fprintf(stderr, "Unknown stats format %s, expected text or json\n", format);
+		return -1;
+	}
+
+	return 0;
+}
+
+static int counter_open(const struct counter *c)
+{
+	struct perf_event_attr attr = {
+		.size = sizeof(attr),
+		.type = c->type,
+		.config = c->config,
+		.disabled = 1,
+		.inherit = 1,
+	};
+	int fd;
+
+	fd = syscall(SYS_perf_event_open, &attr, 0, -1, -1, PERF_FLAG_FD_CLOEXEC);
+	if (fd == -1) {
+		/* Unprivileged users may only count user space */
+		attr.exclude_kernel = 1;
+		attr.exclude_hv = 1;
+		fd = syscall(SYS_perf_event_open, &attr, 0, -1, -1, PERF_FLAG_FD_CLOEXEC);
+	}
+
+	return fd;
+}
+
+/* Start counting for cmd, whose command line was first seen at start */
+void stats_begin(const char *cmd, uint64_t start)
+{
+	if (stats.format == STATS_OFF)
+		return;
+
+	stats.cmd = cmd;
+	stats.start = start;
+	getrusage(RUSAGE_SELF, &stats.usage);
+
+	/* The counters are inherited by the worker threads spawned from here on */
+	for (int i = 0; i < COUNTER_COUNT; i++) {
+		stats.counter_fd[i] = counter_open(&counters[i]);
+		if (stats.counter_fd[i] != -1)
+			ioctl(stats.counter_fd[i], PERF_EVENT_IOC_ENABLE, 0);
+	}
+}
+
+uint64_t stats_start(void)
+{
+	return stats.format == STATS_OFF ? 0 : get_time_ns();
+}
+
+/* Account the time since start, as returned by stats_start(), to a phase */
+void stats_account(enum stats_phase phase, uint64_t start, off_t bytes)
+{
+	uint64_t expected = 0;
+
+	if (stats.format == STATS_OFF)
+		return;
+
+	__atomic_compare_exchange_n(&stats.parse_end, &expected, start, false, __ATOMIC_RELAXED, __ATOMIC_RELAXED);
+	__atomic_add_fetch(&stats.phase_ns[phase], get_time_ns() - start, __ATOMIC_RELAXED);
+	if (bytes > 0)
+		__atomic_add_fetch(&stats.phase_bytes[phase], bytes, __ATOMIC_RELAXED);
+}
+
+/* Count bytes for a phase without timing them */
+void stats_count(enum stats_phase phase, off_t bytes)
+{
+	if (stats.format == STATS_OFF || bytes <= 0)
+		return;
+
+	__atomic_add_fetch(&stats.phase_bytes[phase], bytes, __ATOMIC_RELAXED);
+}
+
+static double seconds(uint64_t ns)
+{
+	return ns / 1e9;
+}
+
+static double mb_per_s(uint64_t bytes, uint64_t ns)
+{
+	return ns ? bytes * 1e3 / ns : 0.0;
+}
+
+static void print_text(int rc, uint64_t wall, uint64_t parse, uint64_t kernel, const struct rusage *usage,
+                       const int64_t *values)
+{
+	uint64_t io = stats.phase_ns[STATS_READ] + stats.phase_ns[STATS_WRITE];
+
+	fprintf(stderr, "Stats for %s (exit status %d):\n", stats.cmd, rc);
+	fprintf(stderr, "  %-8s %10.6f s\n", "parse", seconds(parse));
+	fprintf(stderr, "  %-8s %10.6f s  %jd bytes mapped\n", "map", seconds(stats.phase_ns[STATS_MAP]),
+	        (intmax_t)stats.phase_bytes[STATS_MAP]);
+	fprintf(stderr, "  %-8s %10.6f s  %jd bytes accessed with a fixed width\n", "kernel", seconds(kernel),
+	        (intmax_t)stats.phase_bytes[STATS_ACCESS]);
+	fprintf(stderr, "  %-8s %10.6f s  %jd bytes read (%.1f MB/s), %jd bytes written (%.1f MB/s)\n", "io",
+	        seconds(io), (intmax_t)stats.phase_bytes[STATS_READ],
+	        mb_per_s(stats.phase_bytes[STATS_READ], stats.phase_ns[STATS_READ]),
+	        (intmax_t)stats.phase_bytes[STATS_WRITE],
+	        mb_per_s(stats.phase_bytes[STATS_WRITE], stats.phase_ns[STATS_WRITE]));
+	fprintf(stderr, "  %-8s %10.6f s\n", "unmap", seconds(stats.phase_ns[STATS_UNMAP]));
+	fprintf(stderr, "  %-8s %10.6f s\n", "total", seconds(wall));
+	fprintf(stderr, "  page faults: %ld minor, %ld major\n", usage->ru_minflt, usage->ru_majflt);
+
+	fprintf(stderr, "  counters:");
+	for (int i = 0; i < COUNTER_COUNT; i++) {
+		if (values[i] < 0)
+			fprintf(stderr, " %s n/a", counters[i].name);
+		else
+			fprintf(stderr, " %s %" PRId64, counters[i].name, values[i]);
+		fprintf(stderr, i + 1 < COUNTER_COUNT ? "," : "\n");
+	}
+}
+
+static void print_json(int rc, uint64_t wall, uint64_t parse, uint64_t kernel, const struct rusage *usage,
+                       const int64_t *values)
+{
+	fprintf(stderr, "{\"command\": \"%s\", \"status\": %d, \"wall_ns\": %" PRIu64 ", ", stats.cmd, rc, wall);
+	fprintf(stderr, "\"phases_ns\": {\"parse\": %" PRIu64 ", \"map\": %" PRIu64 ", \"kernel\": %" PRIu64, parse,
+	        stats.phase_ns[STATS_MAP], kernel);
+	fprintf(stderr, ", \"io\": %" PRIu64 ", \"unmap\": %" PRIu64 "}, ",
+	        stats.phase_ns[STATS_READ] + stats.phase_ns[STATS_WRITE], stats.phase_ns[STATS_UNMAP]);
+	fprintf(stderr, "\"bytes\": {");
+	for (int i = 0; i < STATS_PHASES; i++)
+		if (i != STATS_UNMAP)
+			fprintf(stderr, "%s\"%s\": %" PRIu64, i ? ", " : "", phase_names[i], stats.phase_bytes[i]);
+	fprintf(stderr, "}, \"faults\": {\"minor\": %ld, \"major\": %ld}, \"counters\": {", usage->ru_minflt,
+	        usage->ru_majflt);
+	for (int i = 0; i < COUNTER_COUNT; i++) {
+		fprintf(stderr, "%s\"%s\": ", i ? ", " : "", counters[i].name);
+		if (values[i] < 0)
+			fprintf(stderr, "null");
+		else
+			fprintf(stderr, "%" PRId64, values[i]);
+	}
+	fprintf(stderr, "}}\n");
+}
+
+/* Stop counting and print the summary of the command that returned rc */
+void stats_end(int rc)
+{
+	int64_t values[COUNTER_COUNT];
+	uint64_t wall, parse, other, kernel;
+	struct rusage usage;
+	uint64_t start;
+
+	if (stats.format == STATS_OFF)
+		return;
+
+	/* Cached mappings would otherwise only go away at exit, unaccounted */
+	start = stats_start();
+	map_cache_flush();
+	stats_account(STATS_UNMAP, start, 0);
+
+	for (int i = 0; i < COUNTER_COUNT; i++) {
+		uint64_t value;
+
+		values[i] = -1;
+		if (stats.counter_fd[i] == -1)
+			continue;
+		ioctl(stats.counter_fd[i], PERF_EVENT_IOC_DISABLE, 0);
+		if (read(stats.counter_fd[i], &value, sizeof(value)) == sizeof(value))
+			values[i] = value;
+		close(stats.counter_fd[i]);
+	}
+
+	getrusage(RUSAGE_SELF, &usage);
+	usage.ru_minflt -= stats.usage.ru_minflt;
+	usage.ru_majflt -= stats.usage.ru_majflt;
+
+	wall = get_time_ns() - stats.start;
+	parse = stats.parse_end ? stats.parse_end - stats.start : wall;
+	other = parse;
+	for (int i = 0; i < STATS_PHASES; i++)
+		other += stats.phase_ns[i];
+	kernel = wall > other ? wall - other : 0;
+
+	if (stats.format == STATS_JSON)
+		print_json(rc, wall, parse, kernel, &usage, values);
+	else
+		print_text(rc, wall, parse, kernel, &usage, values);
+}
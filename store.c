@@ -1,8 +1,11 @@
+#define _GNU_SOURCE
 #include <ctype.h>
+#include <errno.h>
 #include <fcntl.h>
 #include <getopt.h>
 #include <inttypes.h>
 #include <limits.h>
+#include <pthread.h>
 #include <stdbool.h>
 #include <stdint.h>
 #include <stdio.h>
@@ -10,20 +13,448 @@
 #include <string.h>
 #include <sys/mman.h>
 #include <sys/stat.h>
+#include <sys/sendfile.h>
+#include <time.h>
 #include <unistd.h>
 
 #include "mem.h"
 
+#define DEFAULT_WINDOW_SIZE (64 * 1024 * 1024)
+#define SPLICE_PIPE_SIZE    (1024 * 1024)
+
+enum store_method
+{
+	STORE_AUTO,
+	STORE_WRITE,
+	STORE_SPLICE,
+	STORE_COPY,
+	STORE_URING,
+};
+
+static const char *const store_method_names[] = {"auto", "write", "splice", "copy", "uring"};
+
+struct store_ctx {
+	int mem_fd;
+	int out_fd;
+	enum store_method method;
+	bool out_is_pipe;
+	int pipe_fds[2];
+	char width;
+	char *bounce;
+	struct snapshot *snapshot;
+	bool sparse;
+	off_t holes;
+	struct io_pipeline *pipeline;
+	off_t out_offset;
+};
+
+struct store_window {
+	struct mapped_mem mem;
+	off_t len;
+};
+
+/* Errors meaning "this fd combination can't do zero-copy", not real I/O errors */
+static bool zero_copy_unsupported(int err)
+{
+	return err == EINVAL || err == EFAULT || err == ENOSYS || err == EXDEV || err == EOPNOTSUPP ||
+	       err == EBADF || err == ESPIPE;
+}
+
+/* Seek over all-zero pages instead of writing them, so they end up as holes */
+static int store_sparse(struct store_ctx *ctx, const char *buf, size_t len)
+{
+	size_t page_size = sysconf(_SC_PAGESIZE);
+	size_t pos = 0;
+
+	while (pos < len) {
+		bool zero = mem_is_zero(buf + pos, len - pos < page_size ? len - pos : page_size);
+		size_t end;
+
+		for (end = pos + page_size; end < len; end += page_size)
+			if (mem_is_zero(buf + end, len - end < page_size ? len - end : page_size) != zero)
+				break;
+		if (end > len)
+			end = len;
+
+		if (zero) {
+			if (lseek(ctx->out_fd, end - pos, SEEK_CUR) == -1)
+				return -1;
+			ctx->holes += end - pos;
+		} else if (write_full(ctx->out_fd, buf + pos, end - pos) != end - pos) {
+			return -1;
+		}
+		pos = end;
+	}
+
+	return 0;
+}
+
+static int store_output(struct store_ctx *ctx, const char *buf, size_t len)
+{
+	if (ctx->snapshot)
+		return snapshot_add(ctx->snapshot, buf, len);
+	if (ctx->sparse)
+		return store_sparse(ctx, buf, len);
+
+	if (ctx->method == STORE_URING) {
+		if (io_pipeline_transfer(ctx->pipeline, ctx->out_fd, (char *)buf, len, ctx->out_offset, true))
+			return -1;
+		ctx->out_offset += len;
+		return 0;
+	}
+
+	if (write_full(ctx->out_fd, buf, len) != len)
+		return -1;
+
+	return 0;
+}
+
+static int store_chunk(struct store_ctx *ctx, const char *buf, size_t len)
+{
+	if (!ctx->width)
+		return store_output(ctx, buf, len);
+
+	/* Read the device with the requested access width into a bounce buffer */
+	for (size_t done = 0; done < len; done += BOUNCE_SIZE) {
+		size_t chunk = len - done < BOUNCE_SIZE ? len - done : BOUNCE_SIZE;
+
+		copy_width(ctx->bounce, buf + done, chunk, ctx->width);
+		if (store_output(ctx, ctx->bounce, chunk))
+			return -1;
+	}
+
+	return 0;
+}
+
+/*
+ * When the memory device is a regular file the kernel can move the data file
+ * to file (or file to socket/pipe) without any mapping at all. Returns the
+ * number of bytes copied, which is short of size if the kernel refused.
+ */
+static off_t store_copy(struct store_ctx *ctx, off_t target, off_t size)
+{
+	uint64_t start = stats_start();
+	off_t offset = target;
+	bool use_sendfile = false;
+
+	while (offset - target < size) {
+		size_t len = size - (offset - target);
+		ssize_t ret;
+
+		if (!use_sendfile)
+			ret = copy_file_range(ctx->mem_fd, &offset, ctx->out_fd, NULL, len, 0);
+		else
+			ret = sendfile(ctx->out_fd, ctx->mem_fd, &offset, len);
+
+		if (ret == -1 && errno == EINTR)
+			continue;
+		if (ret == -1 && !use_sendfile && zero_copy_unsupported(errno)) {
+			use_sendfile = true;
+			continue;
+		}
+		if (ret <= 0)
+			break;
+	}
+
+	stats_account(STATS_WRITE, start, offset - target);
+
+	return offset - target;
+}
+
+/*
+ * Splice the data from the memory device fd into the output, straight when
+ * it is a pipe and through one otherwise. Pages vmsplice()d from the mapping
+ * instead would still be referenced by an output pipe after the window is
+ * unmapped, and can't be pinned at all on a /dev/mem mapping. Returns the
+ * number of bytes copied, which is short of size if the kernel refused.
+ */
+static off_t store_splice(struct store_ctx *ctx, off_t target, off_t size)
+{
+	int pipe_in = ctx->out_is_pipe ? ctx->out_fd : ctx->pipe_fds[1];
+	uint64_t start = stats_start();
+	off_t offset = target;
+
+	while (offset - target < size) {
+		size_t len = size - (offset - target);
+		/* Not every device moves the offset along, so only trust the count */
+		off_t pos = offset;
+		ssize_t in, out;
+
+		if (!ctx->out_is_pipe && len > SPLICE_PIPE_SIZE)
+			len = SPLICE_PIPE_SIZE;
+		in = splice(ctx->mem_fd, &pos, pipe_in, NULL, len, SPLICE_F_MOVE);
+		if (in == -1 && errno == EINTR)
+			continue;
+		if (in <= 0)
+			break;
+		offset += in;
+		if (ctx->out_is_pipe)
+			continue;
+
+		for (out = 0; out < in;) {
+			ssize_t ret = splice(ctx->pipe_fds[0], NULL, ctx->out_fd, NULL, in - out, SPLICE_F_MOVE);
+
+			if (ret == -1 && errno == EINTR)
+				continue;
+			if (ret <= 0) {
+				char drain[4096];
+
+				/* Throw away what is left in the pipe, it is rewritten by the caller */
+				offset -= in - out;
+				for (in -= out; in > 0; in -= ret) {
+					ret = read(ctx->pipe_fds[0], drain, in < sizeof(drain) ? in : sizeof(drain));
+					if (ret <= 0)
+						break;
+				}
+				goto out;
+			}
+			out += ret;
+		}
+	}
+
+out:
+	stats_account(STATS_WRITE, start, offset - target);
+
+	return offset - target;
+}
+
+/* Touch every page of a window so it is faulted in before it is written out */
+static void *prefault_window(void *arg)
+{
+	struct store_window *win = arg;
+	long page_size = sysconf(_SC_PAGESIZE);
+	char *p = (char *)((uintptr_t)win->mem.v_ptr & ~(uintptr_t)(page_size - 1));
+
+	for (; p < win->mem.v_ptr + win->len; p += page_size)
+		(void)*(volatile char *)p;
+
+	return NULL;
+}
+
+/*
+ * Slide a bounded mapping window across [target, target + size) so that the
+ * address space used stays at two windows no matter how large the region is.
+ * While one window is being written out the next one is mapped and faulted in
+ * by a helper thread.
+ */
+static int store_windowed(struct store_ctx *ctx, off_t target, off_t size, off_t window)
+{
+	struct store_window cur, next;
+	pthread_t prefetcher;
+	bool prefetching;
+	off_t offset = 0;
+
+	cur.len = size < window ? size : window;
+	if (map_memory_fd(ctx->mem_fd, cur.len, PROT_READ, target, &cur.mem))
+		return -1;
+
+	while (offset < size) {
+		prefetching = false;
+		next.len = 0;
+
+		if (offset + cur.len < size) {
+			next.len = size - offset - cur.len;
+			if (next.len > window)
+				next.len = window;
+			if (map_memory_fd(ctx->mem_fd, next.len, PROT_READ, target + offset + cur.len, &next.mem)) {
+				unmap_memory(&cur.mem);
+				return -1;
+			}
+			madvise(next.mem.base, next.mem.mapped_size, MADV_WILLNEED);
+			prefetching = !pthread_create(&prefetcher, NULL, prefault_window, &next);
+		}
+
+		if (store_chunk(ctx, cur.mem.v_ptr, cur.len)) {
+			perror("Failed writing memory content to file");
+			if (prefetching)
+				pthread_join(prefetcher, NULL);
+			unmap_memory(&cur.mem);
+			if (next.len)
+				unmap_memory(&next.mem);
+			return -1;
+		}
+
+		if (prefetching)
+			pthread_join(prefetcher, NULL);
+
+		unmap_memory(&cur.mem);
+		offset += cur.len;
+		cur = next;
+	}
+
+	return 0;
+}
+
 static void do_store_help(FILE *output)
 {
-	fprintf(output, "Usage:\nmem store [options] <address> <length> <output_file>\n\n");
+	fprintf(output, "Usage:\nmem store [options] <address> <length> <output_file>\n");
+	fprintf(output, "       mem store [options] --snapshot <store_dir> <address> <length> <index_file>\n");
+	fprintf(output, "       mem store --rebuild <store_dir> <index_file> <output_file>\n");
+	fprintf(output, "       mem store [options] --ranges <range_list> <container_file | output_dir>\n\n");
 	fprintf(output, "Store memory content in output file.\n");
 	fprintf(output, "Options:\n");
 	fprintf(output, " -m, --mem-dev\t\t memory device to use (default is /dev/mem)\n");
+	fprintf(output, " -w, --window\t\t size of the sliding mapping window (default is 64MB)\n");
+	fprintf(output, " -M, --method\t\t output method: auto, write, splice, copy or uring (default is auto)\n");
+	fprintf(output, " -q, --queue-depth\t requests kept in flight by the uring method (default is 32)\n");
+	fprintf(output, " -W, --width\t\t read the memory only with [b]yte, [h]alfword, [w]ord or [l]ong accesses\n");
+	fprintf(output, " -z, --sparse\t\t leave all-zero pages as holes in the (truncated) output file\n");
+	fprintf(output, " -S, --snapshot\t\t capture an incremental snapshot into a content addressed store,\n");
+	fprintf(output, "\t\t\t only the pages not already in <store_dir> are written\n");
+	fprintf(output, " -R, --rebuild\t\t rebuild the flat image of a snapshot from <store_dir>\n");
+	fprintf(output, " -r, --ranges\t\t store every \"<address> <length> [name]\" line of <range_list> in one\n");
+	fprintf(output, "\t\t\t indexed container file, ranges sharing pages are mapped together\n");
+	fprintf(output, " -D, --split\t\t with --ranges, write one <name>.bin file per range into <output_dir>\n");
+	fprintf(output, " -t, --threads\t\t number of threads writing ranges (default is 0, automatic)\n");
+	fprintf(output, " -v, --verbose\t\t Report the method used and the achieved throughput\n");
 	fprintf(output, " -h, --help\t\t Display this help screen\n");
 	fprintf(output, "Arguments:\n");
 	fprintf(output, " <address> and <length> can be given in decimal, hexedecimal or octal format\n");
 	fprintf(output, " depending of the prefix (no-prefix, 0x, and 0).\n");
+	fprintf(output, " <output_file> can be - for standard output.\n");
+}
+
+static int open_output(const char *path, int flags)
+{
+	int fd;
+
+	if (!strcmp(path, "-"))
+		return STDOUT_FILENO;
+
+	fd = open(path, O_WRONLY | O_CREAT | flags, 0644);
+	if (fd == -1)
+		perror("Can't open file for output");
+
+	return fd;
+}
+
+static void close_output(int fd)
+{
+	if (fd != STDOUT_FILENO && fd != -1)
+		close(fd);
+}
+
+static int rebuild_snapshot(const char *dir, const char *index_path, const char *path)
+{
+	int fd = open_output(path, 0);
+	int rc;
+
+	if (fd == -1)
+		return EXIT_FAILURE;
+
+	rc = snapshot_rebuild(dir, index_path, fd) ? EXIT_FAILURE : EXIT_SUCCESS;
+	close_output(fd);
+
+	return rc;
+}
+
+struct split_job {
+	const char *dir;
+	const struct range_list *list;
+};
+
+static int store_range_file(int index, void *arg)
+{
+	struct split_job *job = arg;
+	const struct mem_range *r = &job->list->ranges[index];
+	char label[32];
+	char path[PATH_MAX];
+	int fd;
+	int rc = 0;
+
+	snprintf(path, sizeof(path), "%s/%s.bin", job->dir, range_label(r, label, sizeof(label)));
+	fd = open(path, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+	if (fd == -1) {
+		perror(path);
+		return -1;
+	}
+	if (write_full(fd, r->data, r->length) != r->length) {
+		perror(path);
+		rc = -1;
+	}
+	close(fd);
+
+	return rc;
+}
+
+/* Store all the ranges of a range list in one pass, as a container or one file each */
+static int store_ranges(const char *list_path, char *memdev, const char *output, bool split, int threads,
+                        bool verbose)
+{
+	struct range_list list;
+	struct split_job job = {.dir = output, .list = &list};
+	off_t total = 0;
+	uint64_t start, elapsed;
+	struct stat st;
+	int rc = -1;
+	int fd;
+
+	if (range_list_load(list_path, &list))
+		return EXIT_FAILURE;
+	if (range_list_map(&list, memdev, PROT_READ)) {
+		range_list_free(&list);
+		return EXIT_FAILURE;
+	}
+
+	start = get_time_ns();
+	if (split) {
+		if (mkdir(output, 0755) == -1 && errno != EEXIST)
+			perror("Can't create output directory");
+		else
+			rc = run_parallel(list.count, threads, store_range_file, &job);
+	} else {
+		fd = open_output(output, O_TRUNC);
+		if (fd != -1) {
+			/* The ranges are written in parallel at their offsets in the container */
+			if (fstat(fd, &st) || !S_ISREG(st.st_mode))
+				fprintf(stderr, "A range container needs a regular file\n");
+			else if ((rc = range_container_store(fd, &list, threads)))
+				perror("Failed writing range container");
+			close_output(fd);
+		}
+	}
+	elapsed = get_time_ns() - start;
+
+	for (int i = 0; i < list.count; i++)
+		total += list.ranges[i].length;
+	if (verbose && !rc)
+		fprintf(stderr, "Stored %d ranges (%jd bytes) from %d mappings in %.3f s (%.1f MB/s)\n", list.count,
+		        (intmax_t)total, list.span_count, elapsed / 1e9, elapsed ? total * 1e3 / elapsed : 0.0);
+
+	range_list_free(&list);
+
+	return rc ? EXIT_FAILURE : EXIT_SUCCESS;
+}
+
+static enum store_method resolve_method(struct store_ctx *ctx)
+{
+	struct stat st;
+
+	if (fstat(ctx->mem_fd, &st))
+		return STORE_WRITE;
+	if (S_ISREG(st.st_mode))
+		return STORE_COPY;
+	/* Character devices such as /dev/mem can't be spliced from */
+	if (ctx->out_is_pipe && S_ISBLK(st.st_mode))
+		return STORE_SPLICE;
+	if (fstat(ctx->out_fd, &st) == 0 && (S_ISREG(st.st_mode) || S_ISBLK(st.st_mode)))
+		return STORE_URING;
+
+	return STORE_WRITE;
+}
+
+/* Requests complete out of order, so the output has to take positioned writes */
+static int setup_uring(struct store_ctx *ctx, off_t queue_depth)
+{
+	int flags = fcntl(ctx->out_fd, F_GETFL);
+
+	ctx->out_offset = lseek(ctx->out_fd, 0, SEEK_CUR);
+	if (ctx->out_offset == -1 || flags == -1 || (flags & O_APPEND))
+		return -1;
+
+	ctx->pipeline = io_pipeline_open(queue_depth, IO_REQUEST_SIZE);
+
+	return ctx->pipeline ? 0 : -1;
 }
 
 int do_store(int argc, char **argv)
@@ -31,14 +462,39 @@ int do_store(int argc, char **argv)
 	int c;
 	off_t target;
 	off_t size;
-	int out_fd;
+	off_t window = DEFAULT_WINDOW_SIZE;
+	off_t queue_depth = DEFAULT_QUEUE_DEPTH;
+	long page_size = sysconf(_SC_PAGESIZE);
 	char *memdev = "/dev/mem";
-	struct mapped_mem mem;
+	char *snapshot_dir = NULL;
+	char *rebuild_dir = NULL;
+	char *ranges = NULL;
+	bool split = false;
+	off_t threads = 0;
+	struct store_ctx ctx = {.method = STORE_AUTO, .out_fd = -1, .pipe_fds = {-1, -1}};
+	enum store_method requested;
+	bool verbose = false;
+	struct timespec start, end;
+	struct stat st;
+	off_t done = 0;
+	double elapsed;
+	int rc = EXIT_SUCCESS;
 
 	while (1) {
 		// clang-format off
 		static struct option long_options[] = {
 		    {"mem-dev", required_argument, 0, 'm'},
+		    {"window", required_argument, 0, 'w'},
+		    {"method", required_argument, 0, 'M'},
+		    {"queue-depth", required_argument, 0, 'q'},
+		    {"width", required_argument, 0, 'W'},
+		    {"sparse", no_argument, 0, 'z'},
+		    {"snapshot", required_argument, 0, 'S'},
+		    {"rebuild", required_argument, 0, 'R'},
+		    {"ranges", required_argument, 0, 'r'},
+		    {"split", no_argument, 0, 'D'},
+		    {"threads", required_argument, 0, 't'},
+		    {"verbose", no_argument, 0, 'v'},
 			{"help", no_argument, 0, 'h'},
 		    {0, 0, 0, 0}
 		    // clang-format on
@@ -46,7 +502,7 @@ int do_store(int argc, char **argv)
 
 		int option_index = 0;
 
-		c = getopt_long(argc, argv, "m:h", long_options, &option_index);
+		c = getopt_long(argc, argv, "m:w:M:q:W:zS:R:r:Dt:vh", long_options, &option_index);
 
 		/* Detect the end of the options. */
 		if (c == -1)
@@ -56,6 +512,58 @@ int do_store(int argc, char **argv)
 		case 'm':
 			memdev = optarg;
 			break;
+		case 'w':
+			if (parse_input(optarg, &window)) {
+				do_store_help(stderr);
+				return EXIT_FAILURE;
+			}
+			break;
+		case 'M':
+			for (ctx.method = STORE_AUTO; ctx.method <= STORE_URING; ctx.method++)
+				if (!strcmp(optarg, store_method_names[ctx.method]))
+					break;
+			if (ctx.method > STORE_URING) {
+				fprintf(stderr, "Unknown output method %s\n", optarg);
+				return EXIT_FAILURE;
+			}
+			break;
+		case 'q':
+			if (parse_input(optarg, &queue_depth) || queue_depth < 1) {
+				do_store_help(stderr);
+				return EXIT_FAILURE;
+			}
+			break;
+		case 'W':
+			ctx.width = tolower(*optarg);
+			if (!access_size(ctx.width)) {
+				fprintf(stderr, "Unsupported access width %s\n", optarg);
+				return EXIT_FAILURE;
+			}
+			break;
+		case 'z':
+			ctx.sparse = true;
+			break;
+		case 'S':
+			snapshot_dir = optarg;
+			break;
+		case 'R':
+			rebuild_dir = optarg;
+			break;
+		case 'r':
+			ranges = optarg;
+			break;
+		case 'D':
+			split = true;
+			break;
+		case 't':
+			if (parse_input(optarg, &threads)) {
+				do_store_help(stderr);
+				return EXIT_FAILURE;
+			}
+			break;
+		case 'v':
+			verbose = true;
+			break;
 		case 'h':
 			do_store_help(stdout);
 			return EXIT_SUCCESS;
@@ -70,6 +578,28 @@ int do_store(int argc, char **argv)
 		}
 	};
 
+	if (rebuild_dir) {
+		if (argc - optind != 2) {
+			fprintf(stderr, "Missing index or output file\n");
+			do_store_help(stderr);
+			return EXIT_FAILURE;
+		}
+		return rebuild_snapshot(rebuild_dir, argv[optind], argv[optind + 1]);
+	}
+
+	if (ranges) {
+		if (argc - optind != 1) {
+			fprintf(stderr, "Missing output\n");
+			do_store_help(stderr);
+			return EXIT_FAILURE;
+		}
+		if (snapshot_dir || ctx.sparse || ctx.width) {
+			fprintf(stderr, "Range lists can't be combined with snapshots, sparse output or access widths\n");
+			return EXIT_FAILURE;
+		}
+		return store_ranges(ranges, memdev, argv[optind], split, threads, verbose);
+	}
+
 	if (argc - optind != 3) {
 		fprintf(stderr, "Missing address or length\n");
 		do_store_help(stderr);
@@ -78,30 +608,137 @@ int do_store(int argc, char **argv)
 
 	if (parse_input(argv[optind], &target)) {
 		do_store_help(stderr);
-		exit(EXIT_FAILURE);
+		return EXIT_FAILURE;
 	}
 
 	if (parse_input(argv[optind + 1], &size)) {
 		do_store_help(stderr);
-		exit(EXIT_FAILURE);
+		return EXIT_FAILURE;
 	}
 
-	out_fd = open(argv[optind + 2], O_WRONLY | O_CREAT, 0644);
-	if (out_fd == -1) {
-		perror("Can't open file for output");
-		exit(EXIT_FAILURE);
+	if (window < page_size) {
+		fprintf(stderr, "Window size must be at least one page\n");
+		return EXIT_FAILURE;
+	}
+	window -= window % page_size;
+
+	/* Snapshots and holes are decided page by page, so the data has to come through the mapping */
+	if (snapshot_dir && ctx.sparse) {
+		fprintf(stderr, "Snapshot and sparse output are mutual exclusive options\n");
+		return EXIT_FAILURE;
 	}
+	if (snapshot_dir || ctx.sparse)
+		ctx.method = STORE_WRITE;
 
-	if (map_memory(memdev, size, PROT_READ, target, &mem))
-		exit(EXIT_FAILURE);
+	if (ctx.width) {
+		if (!width_aligned(target, size, ctx.width)) {
+			fprintf(stderr, "Address and length must be aligned to the access width\n");
+			return EXIT_FAILURE;
+		}
+		/* Only the mapped path controls the access width */
+		ctx.method = STORE_WRITE;
+		ctx.bounce = malloc(BOUNCE_SIZE);
+		if (!ctx.bounce)
+			return EXIT_FAILURE;
+	}
+
+	if (snapshot_dir) {
+		ctx.snapshot = snapshot_open(snapshot_dir, target, size, page_size);
+		if (!ctx.snapshot) {
+			free(ctx.bounce);
+			return EXIT_FAILURE;
+		}
+	} else {
+		/* Holes only read back as zeros if nothing was there before */
+		ctx.out_fd = open_output(argv[optind + 2], ctx.sparse ? O_TRUNC : 0);
+		if (ctx.out_fd == -1) {
+			free(ctx.bounce);
+			return EXIT_FAILURE;
+		}
+		ctx.out_is_pipe = fstat(ctx.out_fd, &st) == 0 && S_ISFIFO(st.st_mode);
+		if (ctx.sparse && (fstat(ctx.out_fd, &st) || !S_ISREG(st.st_mode))) {
+			fprintf(stderr, "Sparse output needs a regular file\n");
+			close_output(ctx.out_fd);
+			free(ctx.bounce);
+			return EXIT_FAILURE;
+		}
+	}
 
-	if (write(out_fd, mem.v_ptr, size) != size) {
-		perror("Failed writing memory content to file");
+	ctx.mem_fd = open_memory(memdev, PROT_READ, memory_uncached(memdev, target, target + size));
+	if (ctx.mem_fd == -1) {
+		close_output(ctx.out_fd);
+		snapshot_free(ctx.snapshot);
+		free(ctx.bounce);
 		return EXIT_FAILURE;
 	}
 
-	unmap_memory(&mem);
-	close(out_fd);
+	if (ctx.method == STORE_AUTO)
+		ctx.method = resolve_method(&ctx);
+	requested = ctx.method;
+
+	if (ctx.method == STORE_URING && setup_uring(&ctx, queue_depth))
+		ctx.method = STORE_WRITE;
+
+	if (ctx.method == STORE_SPLICE && !ctx.out_is_pipe) {
+		if (pipe(ctx.pipe_fds) == -1) {
+			ctx.method = STORE_WRITE;
+		} else {
+			fcntl(ctx.pipe_fds[1], F_SETPIPE_SZ, SPLICE_PIPE_SIZE);
+		}
+	}
+
+	clock_gettime(CLOCK_MONOTONIC, &start);
+
+	if (ctx.method == STORE_COPY || ctx.method == STORE_SPLICE) {
+		done = ctx.method == STORE_COPY ? store_copy(&ctx, target, size) : store_splice(&ctx, target, size);
+		if (done < size)
+			ctx.method = STORE_WRITE;
+	}
+
+	if (done < size && store_windowed(&ctx, target + done, size - done, window))
+		rc = EXIT_FAILURE;
+
+	/* Leave the file position after the data, as the other methods do */
+	if (ctx.method == STORE_URING)
+		lseek(ctx.out_fd, ctx.out_offset, SEEK_SET);
+
+	/* Trailing holes don't extend the file by themselves */
+	if (ctx.sparse && rc == EXIT_SUCCESS && ftruncate(ctx.out_fd, lseek(ctx.out_fd, 0, SEEK_CUR))) {
+		perror("Failed setting output file size");
+		rc = EXIT_FAILURE;
+	}
+
+	if (ctx.snapshot) {
+		if (rc == EXIT_SUCCESS && snapshot_finish(ctx.snapshot, argv[optind + 2], verbose))
+			rc = EXIT_FAILURE;
+		else if (rc != EXIT_SUCCESS)
+			snapshot_free(ctx.snapshot);
+	}
+
+	clock_gettime(CLOCK_MONOTONIC, &end);
+
+	if (verbose && rc == EXIT_SUCCESS) {
+		elapsed = (end.tv_sec - start.tv_sec) + (end.tv_nsec - start.tv_nsec) / 1e9;
+		fprintf(stderr, "Stored %jd bytes in %.3f s (%.1f MB/s) using %s", (intmax_t)size, elapsed,
+		        elapsed > 0 ? size / elapsed / 1e6 : 0.0, store_method_names[requested]);
+		if (requested != ctx.method)
+			fprintf(stderr, ", fell back to %s", store_method_names[ctx.method]);
+		else if (ctx.method == STORE_URING && strcmp(io_pipeline_engine(ctx.pipeline), "io_uring"))
+			fprintf(stderr, ", fell back to a %s", io_pipeline_engine(ctx.pipeline));
+		if (ctx.sparse)
+			fprintf(stderr, ", %jd bytes left as holes", (intmax_t)ctx.holes);
+		fprintf(stderr, "\n");
+	}
+
+	if (ctx.pipeline)
+		io_pipeline_close(ctx.pipeline, verbose && rc == EXIT_SUCCESS);
+	if (ctx.pipe_fds[0] != -1) {
+		close(ctx.pipe_fds[0]);
+		close(ctx.pipe_fds[1]);
+	}
+	close(ctx.mem_fd);
+	close_output(ctx.out_fd);
+	free(ctx.bounce);
 
-	return EXIT_SUCCESS;
+	return rc;
 }
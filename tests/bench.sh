@@ -0,0 +1,109 @@
+#!/bin/sh
+#
+# Throughput and latency of the main subcommands per size class, measured on
+# a tmpfs file handed to mem with -m in place of /dev/mem. Every run is timed
+# end to end, process start included, and the best of BENCH_REPEATS is kept.
+#
+# The results are written to BENCH_RESULTS as "<subcommand> <size> <MB/s>
+# <latency us>" lines. When BENCH_BASELINE exists, any subcommand whose
+# throughput fell more than BENCH_TOLERANCE percent below its baseline fails
+# the run. BENCH_UPDATE=1 records the results as the new baseline instead.
+
+MEM=${MEM:-./mem}
+BENCH_SIZES=${BENCH_SIZES:-"4096 1048576 67108864"}
+BENCH_REPEATS=${BENCH_REPEATS:-5}
+BENCH_TOLERANCE=${BENCH_TOLERANCE:-25}
+BENCH_RESULTS=${BENCH_RESULTS:-bench.results}
+BENCH_BASELINE=${BENCH_BASELINE:-tests/bench.baseline}
+
+if [ -d /dev/shm ] && [ -w /dev/shm ]; then
+	tmp=$(mktemp -d /dev/shm/mem-bench.XXXXXX)
+else
+	tmp=$(mktemp -d "${TMPDIR:-/tmp}/mem-bench.XXXXXX")
+fi
+[ -n "$tmp" ] || exit 99
+trap 'rm -rf "$tmp"' EXIT INT TERM
+
+dev=$tmp/dev
+max=0
+for size in $BENCH_SIZES; do
+	[ "$size" -gt $max ] && max=$size
+done
+
+# Twice the largest size class, so copy and compare have a second half
+truncate -s $((2 * max)) "$dev" || exit 99
+"$MEM" fill -r 1 -m "$dev" 0 $((2 * max)) >/dev/null || exit 99
+
+now()
+{
+	date +%s%N
+}
+
+# measure <name> <size> <command...>: record the best of BENCH_REPEATS runs
+measure()
+{
+	name=$1
+	size=$2
+	shift 2
+	best=
+	i=0
+	while [ $i -lt "$BENCH_REPEATS" ]; do
+		start=$(now)
+		if ! "$@" >/dev/null 2>"$tmp/log"; then
+			echo "$name $size: failed" >&2
+			cat "$tmp/log" >&2
+			exit 1
+		fi
+		elapsed=$(($(now) - start))
+		if [ -z "$best" ] || [ $elapsed -lt "$best" ]; then
+			best=$elapsed
+		fi
+		i=$((i + 1))
+	done
+	# bytes per nanosecond times 1000 is MB/s
+	awk -v name="$name" -v size="$size" -v ns="$best" \
+		'BEGIN { printf "%-8s %10d %12.1f %12.1f\n", name, size, size * 1000 / ns, ns / 1000 }' \
+		>>"$tmp/results"
+}
+
+: >"$tmp/results"
+for size in $BENCH_SIZES; do
+	dd if="$dev" of="$tmp/image" bs=$size count=1 2>/dev/null
+	measure dump $size "$MEM" dump -v -m "$dev" 0 $size
+	measure store $size "$MEM" store -m "$dev" 0 $size "$tmp/out"
+	measure load $size "$MEM" load -m "$dev" $max "$tmp/image"
+	measure copy $size "$MEM" copy -m "$dev" 0 $max $size
+	measure compare $size "$MEM" compare -m "$dev" 0 $max $size
+	measure hash $size "$MEM" hash -a crc32c -m "$dev" 0 $size
+	measure fill $size "$MEM" fill -m "$dev" $max $size 0
+	rm -f "$tmp/out" "$tmp/image"
+done
+
+cp "$tmp/results" "$BENCH_RESULTS"
+printf "%-8s %10s %12s %12s\n" command size "MB/s" "latency us"
+cat "$BENCH_RESULTS"
+
+if [ "${BENCH_UPDATE:-0}" = 1 ]; then
+	cp "$BENCH_RESULTS" "$BENCH_BASELINE" && echo "Baseline recorded in $BENCH_BASELINE"
+	exit
+fi
+
+if [ ! -f "$BENCH_BASELINE" ]; then
+	echo "No baseline in $BENCH_BASELINE, run make bench-baseline to record one"
+	exit 0
+fi
+
+awk -v tolerance="$BENCH_TOLERANCE" '
+	NR == FNR { base[$1 " " $2] = $3; next }
+	($1 " " $2) in base {
+		floor = base[$1 " " $2] * (100 - tolerance) / 100
+		if ($3 < floor) {
+			printf "REGRESSION: %s %d: %.1f MB/s, baseline %.1f MB/s\n", $1, $2, $3, base[$1 " " $2]
+			failed++
+		}
+	}
+	END {
+		if (failed)
+			exit 1
+		printf "No regression beyond %d%% of the baseline\n", tolerance
+	}' "$BENCH_BASELINE" "$BENCH_RESULTS"
@@ -0,0 +1,238 @@
+#!/bin/sh
+#
+# Regression checks for every subcommand. Physical memory is replaced by
+# plain files on tmpfs (or $TMPDIR) that are handed to mem with -m, and are
+# filled with a seeded pattern so every checksum below is known up front.
+#
+# Run through "make check", or directly with MEM pointing at the binary.
+
+MEM=${MEM:-./mem}
+SIZE=0x800000
+
+# Digests of the 8MB stand-in after "mem fill -r 1"
+SHA256=8d77ac7d6adafc4d5e4cae4b0802ff06fac98aeb90f03c1887080a0f69752adb
+XXH64=2950756898a82a91
+CRC32C=fd4278a7
+
+if [ -d /dev/shm ] && [ -w /dev/shm ]; then
+	tmp=$(mktemp -d /dev/shm/mem-check.XXXXXX)
+else
+	tmp=$(mktemp -d "${TMPDIR:-/tmp}/mem-check.XXXXXX")
+fi
+[ -n "$tmp" ] || exit 99
+trap 'rm -rf "$tmp"' EXIT INT TERM
+
+passed=0
+failed=0
+dev=$tmp/dev
+scratch=$tmp/scratch
+
+ok()
+{
+	passed=$((passed + 1))
+	echo "PASS: $1"
+}
+
+not_ok()
+{
+	failed=$((failed + 1))
+	echo "FAIL: $1"
+	[ -s "$tmp/log" ] && sed 's/^/	/' "$tmp/log"
+}
+
+# check <name> <command...>: the command must succeed
+check()
+{
+	name=$1
+	shift
+	if "$@" >"$tmp/log" 2>&1; then ok "$name"; else not_ok "$name"; fi
+}
+
+# check_fails <name> <command...>: the command must fail
+check_fails()
+{
+	name=$1
+	shift
+	if "$@" >"$tmp/log" 2>&1; then not_ok "$name"; else ok "$name"; fi
+}
+
+# extract <file> <offset> <length> <output>, all page aligned
+extract()
+{
+	dd if="$1" of="$4" bs=4096 skip=$(($2 / 4096)) count=$(($3 / 4096)) 2>/dev/null
+}
+
+# digest <file> <algorithm> <address> <size>: print the bare digest
+digest()
+{
+	"$MEM" hash -m "$1" -a "$2" "$3" "$4" | awk '{ print $NF }'
+}
+
+# reset: make the scratch stand-in a fresh copy of the reference one
+reset()
+{
+	cp "$dev" "$scratch"
+}
+
+truncate -s $((SIZE)) "$dev" || exit 99
+
+# fill
+check "fill random" "$MEM" fill -r 1 -m "$dev" 0 $SIZE
+check "fill sha256" test "$(digest "$dev" sha256 0 $SIZE)" = $SHA256
+check "fill xxh64" test "$(digest "$dev" xxh64 0 $SIZE)" = $XXH64
+check "fill crc32c" test "$(digest "$dev" crc32c 0 $SIZE)" = $CRC32C
+truncate -s $((SIZE)) "$scratch"
+check "fill threads" "$MEM" fill -r 1 -t 4 -m "$scratch" 0 $SIZE
+check "fill threads match" cmp "$dev" "$scratch"
+check "fill verify" "$MEM" fill -V -e w -m "$scratch" 0x1000 0x100000 0xdeadbeef
+check "fill increment" "$MEM" fill -V -i -e l -m "$scratch" 0x200000 0x10000 0
+
+# hash
+check "hash chunks" test "$("$MEM" hash -m "$dev" -a crc32c -c 0x100000 0 $SIZE)" = "crc32c $CRC32C"
+check "hash manifest" test "$("$MEM" hash -m "$dev" -M -c 0x100000 0 $SIZE | wc -l)" -eq 9
+
+# dump
+printf '0x00000100  a8 18 22 be ed 0f 0e 2c  0d a4 d4 d9 2d 2d 24 89 \n' >"$tmp/expected"
+"$MEM" dump -m "$dev" 0x100 0x10 >"$tmp/dump" 2>&1
+check "dump" cmp "$tmp/expected" "$tmp/dump"
+check "dump lines" test "$("$MEM" dump -v -m "$dev" 0 0x1000 | wc -l)" -eq 256
+check "dump u32" test "$("$MEM" dump -f u32 -m "$dev" 0x100 0x10)" = \
+	"0x00000100  be2218a8 2c0e0fed  d9d4a40d 89242d2d"
+check "dump u64 big endian" test "$("$MEM" dump -f u64 -B -m "$dev" 0x100 0x10)" = \
+	"0x00000100  a81822beed0f0e2c  0da4d4d92d2d2489"
+check "dump json" test "$("$MEM" dump -f json:u16 -m "$dev" 0x100 0x4)" = \
+	'{"address":"0x100","word":2,"big_endian":false,"values":["0x18a8","0xbe22"]}'
+check "dump csv" test "$("$MEM" dump -f csv:u32 -m "$dev" 0x100 0x8 | tail -n 1)" = "0x00000104,0x2c0e0fed"
+check_fails "dump unaligned" "$MEM" dump -f u32 -m "$dev" 0x102 0x10
+extract "$dev" 0x3000 0x2000 "$tmp/ref"
+"$MEM" dump -f raw -m "$dev" 0x3000 0x2000 >"$tmp/out"
+check "dump raw" cmp "$tmp/ref" "$tmp/out"
+# Squeezed typed dumps must still read every word once, and only once
+truncate -s $((0x10000)) "$tmp/zero"
+"$MEM" --stats=json dump -f u32 -m "$tmp/zero" 0 0x10000 >"$tmp/out" 2>"$tmp/stats"
+check "dump u32 squeezed" test "$(wc -l <"$tmp/out")" -eq 3
+check "dump u32 reads once" grep -q '"access": 65536[,}]' "$tmp/stats"
+# Lines A A A B squeeze like the byte dump: the last A of the run is shown
+truncate -s $((0x40)) "$tmp/run"
+"$MEM" fill -m "$tmp/run" 0x30 0x10 0x5a >/dev/null
+"$MEM" dump -m "$tmp/run" 0 0x40 | cut -c 1-10 >"$tmp/expected"
+"$MEM" dump -f u32 -m "$tmp/run" 0 0x40 | cut -c 1-10 >"$tmp/out"
+check "dump u32 squeezed run" cmp "$tmp/expected" "$tmp/out"
+check "dump u32 squeezed run lines" test "$(tr '\n' ' ' <"$tmp/out")" = "0x00000000 * 0x00000020 0x00000030 "
+
+# devmem and shell
+reset
+check "devmem write" "$MEM" devmem -m "$scratch" 0x345670 w 0xcafef00d
+"$MEM" devmem -m "$scratch" 0x345670 w >"$tmp/devmem" 2>&1
+check "devmem read" grep -q ': 0xcafef00d$' "$tmp/devmem"
+echo "devmem -m $scratch 0x345670 w" | "$MEM" shell >"$tmp/shell" 2>&1
+check "shell" grep -q ': 0xcafef00d$' "$tmp/shell"
+echo shellx | "$MEM" shell >"$tmp/shell" 2>&1
+check "shell nested" grep -q "Already in a shell" "$tmp/shell"
+echo 'w 0x345670 w 0xzz' >"$tmp/batch"
+check_fails "devmem batch malformed" "$MEM" devmem -m "$scratch" -b "$tmp/batch"
+printf 'r 0x345670 w # %0300d\n' 0 >"$tmp/batch"
+"$MEM" devmem -m "$scratch" -b "$tmp/batch" >"$tmp/devmem" 2>&1
+check "devmem batch long line" grep -q ': 0xcafef00d$' "$tmp/devmem"
+
+# find and poll
+check "find" test "$("$MEM" find -m "$scratch" 0 $SIZE 0xcafef00d)" = 0x345670
+check_fails "find missing" "$MEM" find -m "$scratch" 0 0x1000 0xcafef00d
+check "poll match" "$MEM" poll -m "$scratch" -V 0xcafef00d -t 1000000 0x345670
+check_fails "poll timeout" "$MEM" poll -m "$scratch" -V 0x1 -t 1000 0x345670
+
+# store
+extract "$dev" 0x1000 0x300000 "$tmp/ref"
+for method in write splice copy uring; do
+	check "store $method" "$MEM" store -M $method -m "$dev" 0x1000 0x300000 "$tmp/out"
+	check "store $method data" cmp "$tmp/ref" "$tmp/out"
+	rm -f "$tmp/out"
+done
+"$MEM" store -m "$dev" 0x1000 0x300000 - >"$tmp/out"
+check "store stdout" cmp "$tmp/ref" "$tmp/out"
+check "store width" "$MEM" store -W w -m "$dev" 0x1000 0x300000 "$tmp/out"
+check "store width data" cmp "$tmp/ref" "$tmp/out"
+
+truncate -s $((SIZE)) "$scratch"
+"$MEM" fill -m "$scratch" 0x100000 0x2000 0x5a >/dev/null
+extract "$scratch" 0 $SIZE "$tmp/ref"
+check "store sparse" "$MEM" store -z -m "$scratch" 0 $SIZE "$tmp/out"
+check "store sparse data" cmp "$tmp/ref" "$tmp/out"
+
+# snapshot
+reset
+check "snapshot" "$MEM" store -S "$tmp/store" -m "$scratch" 0 $SIZE "$tmp/index1"
+"$MEM" devmem -m "$scratch" 0x10 w 0x1 >/dev/null
+check "snapshot incremental" "$MEM" store -S "$tmp/store" -m "$scratch" 0 $SIZE "$tmp/index2"
+check "snapshot rebuild" "$MEM" store -R "$tmp/store" "$tmp/index1" "$tmp/out"
+check "snapshot rebuild data" cmp "$dev" "$tmp/out"
+check "snapshot rebuild incremental" "$MEM" store -R "$tmp/store" "$tmp/index2" "$tmp/out"
+check "snapshot rebuild incremental data" cmp "$scratch" "$tmp/out"
+# Index records whose chunk was lost with the end of the pack are dropped
+truncate -s -4096 "$tmp/store/chunks.pack"
+check "snapshot lost chunk" "$MEM" store -S "$tmp/store" -m "$scratch" 0 $SIZE "$tmp/index3"
+rm -f "$tmp/out"
+check "snapshot lost chunk rebuild" "$MEM" store -R "$tmp/store" "$tmp/index3" "$tmp/out"
+check "snapshot lost chunk data" cmp "$scratch" "$tmp/out"
+
+# load
+extract "$dev" 0x400000 0x200000 "$tmp/ref"
+for method in read uring; do
+	truncate -s 0 "$scratch"
+	truncate -s $((SIZE)) "$scratch"
+	check "load $method" "$MEM" load -M $method -m "$scratch" 0x1000 "$tmp/ref"
+	extract "$scratch" 0x1000 0x200000 "$tmp/out"
+	check "load $method data" cmp "$tmp/ref" "$tmp/out"
+done
+check "load width" "$MEM" load -W l -m "$scratch" 0x1000 "$tmp/ref"
+truncate -s $((0x200000)) "$tmp/hole"
+reset
+check "load sparse" "$MEM" load -z -m "$scratch" 0x1000 "$tmp/hole"
+check "load sparse data" test "$(digest "$scratch" sha256 0x1000 0x200000)" = \
+	"$(digest "$tmp/hole" sha256 0 0x200000)"
+
+# copy and compare
+reset
+check "compare equal" "$MEM" compare -m "$dev" 0 0 $SIZE
+check_fails "compare differ" "$MEM" compare -m "$dev" 0 0x1000 0x1000
+check "compare first" test "$("$MEM" compare -f -m "$dev" 0 0x1000 0x100000 | grep -c '^Difference')" -eq 1
+check "copy" "$MEM" copy -m "$scratch" 0 0x400000 0x400000
+check "compare copy" "$MEM" compare -m "$scratch" 0 0x400000 0x400000
+check "copy threads" "$MEM" copy -t 4 -m "$scratch" 0x400000 0x1000 0x200000
+check "compare copy threads" "$MEM" compare -m "$scratch" 0x400000 0x1000 0x200000
+
+# ranges
+cat >"$tmp/ranges" <<'EOF'
+# address  length  name
+0x1000     0x800    head
+0x1400     0x2000   overlap
+0x700000   0x10000  tail
+EOF
+check "store ranges" "$MEM" store -r "$tmp/ranges" -m "$dev" "$tmp/container"
+check "compare ranges" "$MEM" compare -r "$tmp/ranges" -m "$dev" "$tmp/container"
+reset
+"$MEM" devmem -m "$scratch" 0x700010 w 0xcafef00d >/dev/null
+check_fails "compare ranges differ" "$MEM" compare -r "$tmp/ranges" -m "$scratch" "$tmp/container"
+check "hash ranges" test "$("$MEM" hash -r "$tmp/ranges" -m "$dev" | wc -l)" -eq 3
+echo '0x1000 0x100 bad,name' >"$tmp/bad-ranges"
+check_fails "ranges reserved name" "$MEM" hash -r "$tmp/bad-ranges" -m "$dev"
+printf '0x1000 0x100\n0x1000 0x200\n' >"$tmp/bad-ranges"
+check_fails "ranges duplicate label" "$MEM" hash -r "$tmp/bad-ranges" -m "$dev"
+# A truncated container is an error, not a SIGBUS
+cp "$tmp/container" "$tmp/truncated"
+truncate -s -4096 "$tmp/truncated"
+"$MEM" compare -r "$tmp/ranges" -m "$dev" "$tmp/truncated" >/dev/null 2>"$tmp/out"
+check "compare ranges truncated" grep -q "outside the container" "$tmp/out"
+mkdir "$tmp/split"
+check "store ranges split" "$MEM" store -r "$tmp/ranges" -D -m "$dev" "$tmp/split"
+extract "$dev" 0x700000 0x10000 "$tmp/ref"
+check "store ranges split data" cmp "$tmp/ref" "$tmp/split/tail.bin"
+
+# test and bench
+reset
+check "test" "$MEM" test -m "$scratch" 0 0x100000
+check "bench" "$MEM" bench -r 1 -w 0 -m "$scratch" 0 0x100000
+check_fails "bench wc without a wc file" "$MEM" --cache wc bench -k read -r 1 -w 0 -m "$scratch" 0 0x100000
+
+echo "$passed passed, $failed failed"
+[ $failed -eq 0 ]